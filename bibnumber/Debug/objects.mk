@@ -4,5 +4,5 @@
 
 USER_OBJS :=
 
-LIBS := -llept -lopencv_imgproc -lopencv_objdetect -ltesseract -lopencv_core -lopencv_highgui -lboost_filesystem -lboost_system -lopencv_ml
+LIBS := -llept -lopencv_imgproc -lopencv_objdetect -ltesseract -lopencv_core -lopencv_highgui -lboost_filesystem -lboost_system -lboost_thread -lz -lopencv_ml
 
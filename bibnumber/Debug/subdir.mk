@@ -5,33 +5,63 @@
 # Add inputs and outputs from these tool invocations to the build variables 
 CPP_SRCS += \
 ../batch.cpp \
+../bibdetection.cpp \
 ../bibnumber.cpp \
+../cropwriter.cpp \
+../digitclassifier.cpp \
+../exif.cpp \
 ../facedetection.cpp \
+../fasthog.cpp \
+../featurestore.cpp \
+../imageloader.cpp \
+../linearsvm.cpp \
 ../log.cpp \
 ../pipeline.cpp \
+../tar.cpp \
 ../textdetection.cpp \
 ../textrecognition.cpp \
-../train.cpp 
+../train.cpp \
+../zip.cpp 
 
 OBJS += \
 ./batch.o \
+./bibdetection.o \
 ./bibnumber.o \
+./cropwriter.o \
+./digitclassifier.o \
+./exif.o \
 ./facedetection.o \
+./fasthog.o \
+./featurestore.o \
+./imageloader.o \
+./linearsvm.o \
 ./log.o \
 ./pipeline.o \
+./tar.o \
 ./textdetection.o \
 ./textrecognition.o \
-./train.o 
+./train.o \
+./zip.o 
 
 CPP_DEPS += \
 ./batch.d \
+./bibdetection.d \
 ./bibnumber.d \
+./cropwriter.d \
+./digitclassifier.d \
+./exif.d \
 ./facedetection.d \
+./fasthog.d \
+./featurestore.d \
+./imageloader.d \
+./linearsvm.d \
 ./log.d \
 ./pipeline.d \
+./tar.d \
 ./textdetection.d \
 ./textrecognition.d \
-./train.d 
+./train.d \
+./zip.d 
 
 
 # Each subdirectory must supply rules for building sources it contributes
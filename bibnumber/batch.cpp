@@ -4,6 +4,7 @@
 #include <sstream>
 #include <vector>
 #include <string>
+#include <map>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/bimap.hpp>
 #include <boost/bimap/set_of.hpp>
@@ -15,6 +16,10 @@
 
 #include "batch.h"
 #include "pipeline.h"
+#include "imageloader.h"
+#include "exif.h"
+#include "tar.h"
+#include "zip.h"
 #include "log.h"
 
 namespace bimaps = boost::bimaps;
@@ -64,36 +69,75 @@ int batch(const char *path) {
 }
 #endif
 
+/**
+ * Process an image file (or archive entry) named fileName, read into data
+ */
 static int processSingleImage(
 		std::string fileName,
-		std::string svmModel,
+		const std::vector<uchar>& data,
+		const struct imageloader::LoadInfo& info,
 		pipeline::Pipeline &pipeline,
-		std::vector<int>& bibNumbers)
+		std::vector<int>& bibNumbers,
+		std::vector<struct textrecognition::OcrConfidence>& confidences)
 {
 	int res;
 
-	std::cout << "Processing file " << fileName << std::endl;
+	std::cout << "Processing file " << fileName << " (" << info.bytes / 1024
+			<< " kB, " << info.bytes / (info.readSeconds + 1e-9) / 1e6
+			<< " MB/s, " << info.waitSeconds * 1000 << " ms I/O wait)"
+			<< std::endl;
+
+	/* skip images whose thumbnail has no text */
+	struct exif::ExifInfo exifInfo;
+	exif::parse(data, exifInfo);
+	cv::Mat thumbnail;
+	if (pipeline.hasPrescreen())
+		thumbnail = exif::thumbnail(data, exifInfo);
+	if (!thumbnail.empty()) {
+		exif::orient(thumbnail, exifInfo.orientation);
+		if (!pipeline.prescreen(thumbnail)) {
+			std::cout << "Read: [] (no text in thumbnail)" << std::endl;
+			return 0;
+		}
+	}
 
-	/* open image */
-	cv::Mat image = cv::imread(fileName, 1);
+	/* decode image, upright */
+	cv::Mat image;
+	if (!data.empty())
+		image = cv::imdecode(data, 1);
 	if (image.empty()) {
 		std::cerr << "ERROR:Failed to open image file" << std::endl;
 		return -1;
 	}
+	exif::orient(image, exifInfo.orientation);
 
 	/* process image */
-	res = pipeline.processImage(image, svmModel, bibNumbers);
+	pipeline.setImageName(fileName);
+	res = pipeline.processImage(image, bibNumbers, confidences);
 	if (res < 0) {
 		std::cerr << "ERROR: Could not process image" << std::endl;
 		return -1;
 	}
 
-	/* remove duplicates */
-	std::sort(bibNumbers.begin(), bibNumbers.end());
-	bibNumbers.erase(std::unique(bibNumbers.begin(), bibNumbers.end()),
-			bibNumbers.end());
+	/* remove duplicates, keeping the most confident reading */
+	std::map<int, struct textrecognition::OcrConfidence> unique;
+	for (unsigned int i = 0; i < bibNumbers.size(); i++) {
+		std::map<int, struct textrecognition::OcrConfidence>::iterator it =
+				unique.find(bibNumbers[i]);
+		if ((it == unique.end()) || (confidences[i].word > it->second.word))
+			unique[bibNumbers[i]] = confidences[i];
+	}
+	bibNumbers.clear();
+	confidences.clear();
+	for (std::map<int, struct textrecognition::OcrConfidence>::iterator it =
+			unique.begin(); it != unique.end(); ++it) {
+		bibNumbers.push_back(it->first);
+		confidences.push_back(it->second);
+	}
 
 	/* display result */
+	if (res > 0)
+		std::cout << "(degraded) ";
 	std::cout << "Read: [";
 	for (std::vector<int>::iterator it = bibNumbers.begin();
 			it != bibNumbers.end(); ++it) {
@@ -104,12 +148,96 @@ static int processSingleImage(
 	return res;
 }
 
+/* JSON string with quotes and backslashes escaped */
+static std::string jsonString(const std::string &s) {
+	std::string out("\"");
+	for (unsigned int i = 0; i < s.size(); i++) {
+		if ((s[i] == '"') || (s[i] == '\\'))
+			out += '\\';
+		out += s[i];
+	}
+	return out + "\"";
+}
+
+/* JSON number, null if the confidence is unknown */
+static std::string jsonConfidence(float confidence) {
+	std::ostringstream out;
+	if (confidence < 0)
+		return "null";
+	out << confidence;
+	return out.str();
+}
+
+/**
+ * Write the bib numbers read in one image as a JSON object
+ */
+static void writeJsonImage(std::ostream &out, const std::string &fileName,
+		const std::vector<int>& bibNumbers,
+		const std::vector<struct textrecognition::OcrConfidence>& confidences,
+		bool degraded) {
+	out << "  {\"file\": " << jsonString(fileName) << ", \"degraded\": "
+			<< (degraded ? "true" : "false") << ", \"bibs\": [";
+	for (unsigned int i = 0; i < bibNumbers.size(); i++) {
+		out << (i ? ", " : "") << "{\"number\": " << bibNumbers[i]
+				<< ", \"confidence\": " << jsonConfidence(confidences[i].word)
+				<< ", \"chars\": [";
+		for (unsigned int j = 0; j < confidences[i].chars.size(); j++)
+			out << (j ? ", " : "") << jsonConfidence(confidences[i].chars[j]);
+		out << "]}";
+	}
+	out << "]}";
+}
+
+static void printOcrStats(const pipeline::Pipeline &pipeline) {
+	const struct textrecognition::OcrStats &stats = pipeline.getOcrStats();
+	if (stats.seconds <= 0)
+		return;
+	std::cout << "OCR: " << stats.chains << " chains in " << stats.calls
+			<< " calls, " << stats.seconds << "s, " << stats.calls / stats.seconds
+			<< " calls/s, " << stats.chains / stats.seconds << " chains/s, "
+			<< stats.dropped << " chains dropped by OCR budget" << std::endl;
+}
+
+static void printIoStats(const imageloader::ImageLoader &loader) {
+	const struct imageloader::IoStats &stats = loader.getStats();
+	if (stats.files == 0)
+		return;
+	std::cout << "I/O: " << stats.files << " files, " << stats.bytes / 1e6
+			<< " MB read in " << stats.readSeconds << "s ("
+			<< stats.bytes / (stats.readSeconds + 1e-9) / 1e6 << " MB/s), "
+			<< stats.waitSeconds << "s waiting for I/O ("
+			<< stats.waitSeconds * 1000 / stats.files << " ms/image)"
+			<< std::endl;
+}
+
 static int exists(std::vector<int> arr, int item) {
 	return std::find(arr.begin(), arr.end(), item) != arr.end();
 }
 
+/**
+ * Process the next image of loader
+ */
+static int processNextImage(imageloader::ImageLoader &loader,
+		pipeline::Pipeline &pipeline,
+		std::vector<int>& bibNumbers,
+		std::vector<struct textrecognition::OcrConfidence>& confidences)
+{
+	std::string name;
+	std::vector<uchar> data;
+	struct imageloader::LoadInfo info;
+
+	if (loader.next(name, data, info) == 0)
+		return -1;
+	return processSingleImage(name, data, info, pipeline, bibNumbers,
+			confidences);
+}
+
 namespace batch {
 
+bool isArchive(std::string name) {
+	return tar::isArchive(name) || zip::isArchive(name);
+}
+
 bool isImageFile(std::string name) {
 	std::string lower_case(name);
 	std::transform(lower_case.begin(), lower_case.end(), lower_case.begin(),
@@ -142,31 +270,36 @@ std::vector<fs::path> getImageFiles(std::string dir)
 	return imgFiles;
 }
 
-int process(std::string inputName, std::string svmModel) {
+int process(std::string inputName, const struct pipeline::PipelineParams &params) {
 	int res;
 
 	std::string resultFileName("out.csv");
+	std::string jsonFileName("out.json");
 
 	if (!fs::exists(inputName)) {
 		std::cerr << "ERROR: Not found: " << inputName << std::endl;
 		return -1;
 	}
 
-	pipeline::Pipeline pipeline;
+	pipeline::Pipeline pipeline(params);
+	imageloader::ImageLoader loader(params.prefetchBytes);
 
-	if (fs::is_regular_file(inputName)) {
+	if (fs::is_regular_file(inputName) && !isArchive(inputName)) {
 		/* convert name to lower case to make extension checks easier */
 		std::string name(inputName);
 		std::transform(name.begin(), name.end(), name.begin(), ::tolower);
 
 		if (isImageFile(inputName)) {
 			std::vector<int> bibNumbers;
-			res = processSingleImage(inputName, svmModel, pipeline, bibNumbers);
+			std::vector<struct textrecognition::OcrConfidence> confidences;
+			loader.start(std::vector<std::string>(1, inputName));
+			res = processNextImage(loader, pipeline, bibNumbers, confidences);
 		} else if (boost::algorithm::ends_with(name, ".csv")) {
 
 			int true_positives = 0;
 			int false_positives = 0;
 			int relevant = 0;
+			int degraded = 0;
 
 			/* set log mask to minimum */
 			biblog::set_log_mask(LOG_NONE);
@@ -175,16 +308,27 @@ int process(std::string inputName, std::string svmModel) {
 			fs::path pathname(inputName);
 			fs::path dirname = pathname.parent_path();
 
-			CSVRow row;
-			while (file >> row) {
-				std::string filename = row[0];
+			/* read all rows first, so that images are read ahead */
+			CSVRow line;
+			std::vector<CSVRow> rows;
+			std::vector<std::string> paths;
+			while (file >> line) {
+				if (line.size() == 0)
+					continue;
+				rows.push_back(line);
+				paths.push_back((dirname / fs::path(line[0])).string());
+			}
+			loader.start(paths);
+
+			for (unsigned int k = 0; k < rows.size(); k++) {
+				const CSVRow &row = rows[k];
 				std::vector<int> groundTruthNumbers;
 				std::vector<int> bibNumbers;
+				std::vector<struct textrecognition::OcrConfidence> confidences;
 
-				fs::path file(filename);
-				fs::path full_path = dirname / file;
-
-				processSingleImage(full_path.string(), svmModel, pipeline, bibNumbers);
+				if (processNextImage(loader, pipeline, bibNumbers, confidences)
+						> 0)
+					degraded++;
 
 				for (unsigned int i = 1; i < row.size(); i++)
 					groundTruthNumbers.push_back(atoi(row[i].c_str()));
@@ -223,43 +367,142 @@ int process(std::string inputName, std::string svmModel) {
 			std::cout << "recall=" << true_positives << "/" << relevant << "="
 					<< recall << std::endl;
 			std::cout << "F-score=" << fscore << std::endl;
+			printOcrStats(pipeline);
+			printIoStats(loader);
+			if (degraded)
+				std::cout << degraded << " images exceeded the time budget"
+						<< std::endl;
 
 		}
-	} else if (fs::is_directory(inputName)) {
-
-		fs::path outPath = inputName / fs::path(resultFileName);
-		std::cout << "Processing directory " << inputName << " into "
-				<< outPath.string() << std::endl;
+	} else if (fs::is_directory(inputName) || isArchive(inputName)) {
+		/* results of an archive are saved next to it, as <archive>.out.csv */
+		bool archive = !fs::is_directory(inputName);
+		fs::path outPath = archive ?
+				fs::path(inputName + "." + resultFileName) :
+				inputName / fs::path(resultFileName);
+		std::cout << "Processing " << (archive ? "archive " : "directory ")
+				<< inputName << " into " << outPath.string() << std::endl;
 
 		std::ofstream outFile;
 		outFile.open(outPath.c_str());
 
+		/* bib numbers and OCR confidences of each image */
+		fs::path jsonPath = archive ?
+				fs::path(inputName + "." + jsonFileName) :
+				inputName / fs::path(jsonFileName);
+		std::ofstream jsonFile;
+		jsonFile.open(jsonPath.c_str());
+		jsonFile << "[" << std::endl;
+
 		/* set log mask to minimum */
 		biblog::set_log_mask(LOG_NONE);
 
-		std::vector<fs::path> img_paths; // vector of image paths
+		std::vector<std::string> img_paths; // image files or archive!entry
 
 		typedef boost::bimap<bimaps::multiset_of<std::string>,
 				bimaps::multiset_of<int> > imgTagBimap;
 
 		imgTagBimap tags;
 
-		/* find images in directory */
-		img_paths = getImageFiles(inputName);
+		/* find images in directory, or stream them from the archive */
+		unsigned int nImages = 0; /* unknown for archives */
+		if (archive) {
+			if (loader.startArchive(inputName, isImageFile) < 0)
+				return -1;
+		} else {
+			std::vector<fs::path> files = getImageFiles(inputName);
+			std::vector<std::string> paths;
+			for (unsigned int i = 0; i < files.size(); i++)
+				paths.push_back(files[i].string());
+			nImages = paths.size();
+			loader.start(paths);
+		}
 
 		/* process images */
-		for (int i = 0, j=img_paths.size(); i<j ; i++) {
-			std::vector<int> bibNumbers;
+		std::vector<std::vector<int> > bibNumbers;
+		std::vector<std::vector<struct textrecognition::OcrConfidence> > confidences;
+		std::vector<bool> degraded;
+		std::vector<int> requeued;
+		/* contents of the degraded archive entries, kept to process them
+		 * again (files are read again) */
+		std::vector<std::vector<uchar> > requeuedData;
+		std::vector<struct imageloader::LoadInfo> requeuedInfo;
+		std::string name;
+		std::vector<uchar> data;
+		struct imageloader::LoadInfo info;
+		while (loader.next(name, data, info) != 0) {
+			int i = img_paths.size();
+			img_paths.push_back(name);
+			bibNumbers.push_back(std::vector<int>());
+			confidences.push_back(
+					std::vector<struct textrecognition::OcrConfidence>());
+			degraded.push_back(false);
+			std::cout << std::endl << "[" << i+1;
+			if (nImages)
+				std::cout << "/" << nImages;
+			std::cout << "] ";
+			res = processSingleImage(name, data, info, pipeline, bibNumbers[i],
+					confidences[i]);
+			if (res > 0) {
+				degraded[i] = true;
+				requeued.push_back(i);
+				if (params.retryDegraded && archive) {
+					requeuedData.push_back(std::vector<uchar>());
+					requeuedData.back().swap(data);
+					requeuedInfo.push_back(info);
+				}
+			}
+		}
+
+		/* process images degraded by the time budget again, without budget */
+		if (params.retryDegraded && !requeued.empty()) {
+			std::cout << std::endl << "Re-processing " << requeued.size()
+					<< " degraded images without time budget" << std::endl;
+			pipeline.setImageBudget(0);
+			if (!archive) {
+				std::vector<std::string> paths;
+				for (unsigned int k = 0; k < requeued.size(); k++)
+					paths.push_back(img_paths[requeued[k]]);
+				loader.start(paths);
+			}
+			for (unsigned int k = 0; k < requeued.size(); k++) {
+				int i = requeued[k];
+				bibNumbers[i].clear();
+				confidences[i].clear();
+				if (archive) {
+					data.swap(requeuedData[k]);
+					info = requeuedInfo[k];
+				} else {
+					loader.next(name, data, info);
+				}
+				std::cout << std::endl << "[" << k+1 << "/" << requeued.size() << "] ";
+				res = processSingleImage(img_paths[i], data, info, pipeline,
+						bibNumbers[i], confidences[i]);
+				degraded[i] = (res > 0);
+			}
+			pipeline.setImageBudget(params.imageBudget);
+		}
 
-			std::cout << std::endl << "[" << i+1 << "/" << j << "] ";
-			res = processSingleImage(img_paths[i].string(), svmModel, pipeline, bibNumbers);
+		int nDegraded = 0;
+		for (int i = 0, j=img_paths.size(); i<j ; i++) {
+			writeJsonImage(jsonFile, img_paths[i], bibNumbers[i],
+					confidences[i], degraded[i]);
+			jsonFile << ((i < j - 1) ? "," : "") << std::endl;
+			if (degraded[i])
+				nDegraded++;
 
-			for (unsigned int k = 0; k < bibNumbers.size(); k++) {
+			for (unsigned int k = 0; k < bibNumbers[i].size(); k++) {
 				tags.insert(
-						imgTagBimap::value_type(img_paths[i].string(), bibNumbers[k]));
+						imgTagBimap::value_type(img_paths[i], bibNumbers[i][k]));
 			}
 		}
 
+		printOcrStats(pipeline);
+		printIoStats(loader);
+		if (!requeued.empty())
+			std::cout << requeued.size() << " images exceeded the time budget, "
+					<< nDegraded << " results degraded" << std::endl;
+
 		/* save results to .csv file */
 		std::cout << "Saving results to " << outPath.string() << std::endl;
 		int current_bib = 0;
@@ -272,6 +515,9 @@ int process(std::string inputName, std::string svmModel) {
 			outFile << it->second << ",";
 		}
 		outFile.close();
+		jsonFile << "]" << std::endl;
+		jsonFile.close();
+		std::cout << "Saved confidences to " << jsonPath.string() << std::endl;
 
 		return -1;
 	} else {
@@ -4,11 +4,15 @@
 #include <string>
 #include <boost/filesystem.hpp>
 
+#include "pipeline.h"
+
 namespace batch
 {
 	bool isImageFile(std::string name);
+	/* tar or zip archive of images */
+	bool isArchive(std::string name);
 	std::vector<boost::filesystem::path> getImageFiles(std::string dir);
-	int process(std::string inputName, std::string svmModel);
+	int process(std::string inputName, const struct pipeline::PipelineParams &params);
 }
 
 #endif /* #ifndef BATCH_H */
@@ -0,0 +1,140 @@
+#include <iostream>
+#include <algorithm>
+
+#include "opencv2/objdetect/objdetect.hpp"
+
+#include "bibdetection.h"
+#include "log.h"
+
+struct Detection {
+	double score;
+	cv::Rect box;
+};
+
+static bool detectionSort(const Detection &lhs, const Detection &rhs) {
+	return lhs.score > rhs.score;
+}
+
+/**
+ * Run the detector on one pyramid level per iteration, detections are
+ * mapped back to input image coordinates. No level is started once the time
+ * budget is exceeded.
+ */
+class PyramidLevelInvoker: public cv::ParallelLoopBody {
+public:
+	PyramidLevelInvoker(const cv::Mat& _img, const cv::HOGDescriptor& _hog,
+			const std::vector<double>& _scales, double _hitThreshold,
+			const deadline::Deadline *_deadline,
+			std::vector<std::vector<Detection> >& _detections) :
+			img(_img), hog(_hog), scales(_scales), hitThreshold(
+					_hitThreshold), deadline(_deadline), detections(
+					_detections) {
+	}
+
+	virtual void operator()(const cv::Range& range) const {
+		for (int i = range.start; i < range.end; i++) {
+			double scale = scales[i];
+			std::vector<cv::Point> locations;
+			std::vector<double> weights;
+			cv::Mat level;
+
+			if (deadline && deadline->expired()) {
+				LOGL(LOG_SVM,
+						"Time budget exceeded, skipping pyramid level " << i);
+				continue;
+			}
+			if (scale == 1.0)
+				level = img;
+			else
+				cv::resize(img, level,
+						cv::Size(cvRound(img.cols / scale),
+								cvRound(img.rows / scale)), 0, 0,
+						cv::INTER_AREA);
+
+			hog.detect(level, locations, weights, hitThreshold,
+					hog.blockStride);
+
+			for (unsigned int j = 0; j < locations.size(); j++) {
+				Detection d;
+				d.score = weights[j];
+				d.box = cv::Rect(cvRound(locations[j].x * scale),
+						cvRound(locations[j].y * scale),
+						cvRound(hog.winSize.width * scale),
+						cvRound(hog.winSize.height * scale))
+						& cv::Rect(0, 0, img.cols, img.rows);
+				detections[i].push_back(d);
+			}
+		}
+	}
+
+private:
+	const cv::Mat& img;
+	const cv::HOGDescriptor& hog;
+	const std::vector<double>& scales;
+	double hitThreshold;
+	const deadline::Deadline *deadline;
+	std::vector<std::vector<Detection> >& detections;
+};
+
+static double overlap(const cv::Rect& a, const cv::Rect& b) {
+	double intersection = (a & b).area();
+	return intersection / (a.area() + b.area() - intersection);
+}
+
+namespace bibdetection {
+
+int processImage(const cv::Mat& img, const linearsvm::LinearModel& model,
+		const struct BibDetectionParams &params, std::vector<cv::Rect>& bibs,
+		std::vector<double>& scores) {
+
+	if (model.empty()) {
+		std::cerr << "ERROR: No SVM model for bib detection" << std::endl;
+		return -1;
+	}
+
+	cv::HOGDescriptor hog = model.getHOG();
+	hog.setSVMDetector(model.detector());
+
+	/* find pyramid scales: from smallest searched bib to full image */
+	std::vector<double> scales;
+	for (double scale = std::max(1.0,
+			(double) params.minBibWidth / hog.winSize.width);
+			(img.cols / scale >= hog.winSize.width)
+					&& (img.rows / scale >= hog.winSize.height); scale *=
+					params.scaleStep) {
+		scales.push_back(scale);
+	}
+
+	std::vector<std::vector<Detection> > levelDetections(scales.size());
+	cv::parallel_for_(cv::Range(0, scales.size()),
+			PyramidLevelInvoker(img, hog, scales, params.hitThreshold,
+					params.deadline, levelDetections));
+
+	std::vector<Detection> detections;
+	for (unsigned int i = 0; i < levelDetections.size(); i++)
+		detections.insert(detections.end(), levelDetections[i].begin(),
+				levelDetections[i].end());
+
+	/* non-maximum suppression */
+	std::sort(detections.begin(), detections.end(), &detectionSort);
+	for (unsigned int i = 0; i < detections.size(); i++) {
+		unsigned int j;
+		for (j = 0; j < bibs.size(); j++) {
+			if (overlap(detections[i].box, bibs[j]) > params.nmsOverlap)
+				break;
+		}
+		if (j < bibs.size())
+			continue;
+		LOGL(LOG_SVM,
+				"Bib detection " << detections[i].box << " score=" << detections[i].score);
+		bibs.push_back(detections[i].box);
+		scores.push_back(detections[i].score);
+	}
+
+	LOGL(LOG_SVM,
+			bibs.size() << " bib detections (" << detections.size() << " before NMS, " << scales.size() << " pyramid levels)");
+
+	return 0;
+}
+
+} /* namespace bibdetection */
@@ -0,0 +1,34 @@
+#ifndef BIBDETECTION_H
+#define BIBDETECTION_H
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "deadline.h"
+#include "linearsvm.h"
+
+namespace bibdetection
+{
+	struct BibDetectionParams {
+		double scaleStep; /* image pyramid scale factor between levels */
+		double hitThreshold; /* minimum detector score */
+		double nmsOverlap; /* max overlap (intersection/union) of kept boxes */
+		int minBibWidth; /* bibs narrower than this are not searched */
+		const deadline::Deadline *deadline; /* per-image time budget, NULL for none */
+	};
+
+	/**
+	 * Detect bibs with the HOG+SVM model over an image pyramid, levels are
+	 * processed in parallel and overlapping detections are suppressed. Levels
+	 * not started when the time budget runs out are skipped.
+	 * @param img input image
+	 * @param model trained linear model
+	 * @param params detection parameters
+	 * @param bibs detected bib regions, best first
+	 * @param scores detector score of each bib region
+	 */
+	int processImage(const cv::Mat& img, const linearsvm::LinearModel& model,
+			const struct BibDetectionParams &params,
+			std::vector<cv::Rect>& bibs, std::vector<double>& scores);
+}
+
+#endif /* #ifndef BIBDETECTION_H */
@@ -2,17 +2,69 @@
 #include <iostream>
 #include <iterator>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "batch.h"
 #include "train.h"
+#include "featurestore.h"
+#include "linearsvm.h"
+#include "fasthog.h"
+#include "digitclassifier.h"
+#include "log.h"
 
 using namespace std;
 
 static void help() {
 	cout << "\nThis program extracts bib numbers from images.\n"
 			"Usage:\n"
-			"./bibnumber [-train dir] [-model svmModel.xml] image_file|folder_path|csv_ground_truth_file\n\n"
+			"./bibnumber [-v] [-train dir] [-features dir] [-augment variants] [-hard-negatives rounds] [-solver dcd|cvsvm] [-C value[,value...]] [-cv folds] [-compare-solvers] [-model svmModel.xml] [-detect swt|hog|both] [-ocr chain|page] [-ocr-budget chains] [-budget ms] [-retry-degraded] [-skip-checks confidence length] [-digits digitModel.xml] [-crops png|jpg|none] [-crop-level level] [-crop-archive crops.tar] [-prefetch MB] [-prescreen density] [-no-debug-images] [-canny low high] [-color-dist distance] image_file|folder_path|zip_or_tar_archive|csv_ground_truth_file\n"
+			"./bibnumber -features dir -compact\n"
+			"./bibnumber -convert svmModel.xml svmModel.bin\n"
+			"./bibnumber -verify-hog image_file|folder_path\n"
+			"./bibnumber [-C value] -train-digits dir|crops.tar\n\n"
+			"  -v: verbose training output (one line per training example)\n"
+			"  -train: directory or crop archive (.tar) of positive bib crops\n"
+			"  -features: HOG feature cache directory, reused across -train runs\n"
+			"  -compact: prune and compact the feature cache\n"
+			"  -augment: augmented variants (rotated, scaled, brightness-shifted,\n"
+			"            blurred) generated in memory per positive\n"
+			"  -hard-negatives: number of hard-negative mining rounds after training\n"
+			"  -solver: linear SVM solver, dual coordinate descent (default) or CvSVM\n"
+			"  -C: SVM penalty parameter (default 1), or a list of values for -cv\n"
+			"  -cv: k-fold cross-validation of the -C values, trains with the best one\n"
+			"  -compare-solvers: report held-out accuracy of both solvers\n"
+			"  -detect: text detection over the full image (swt, default), in HOG+SVM\n"
+			"           bib detections only (hog, requires -model) or both\n"
+			"  -convert: convert an XML SVM model to the compact binary format\n"
+			"  -ocr: one Tesseract call per chain (chain, default) or all chains of\n"
+			"        an image tiled into one page (page)\n"
+			"  -ocr-budget: maximum number of chains read per image, best scoring first\n"
+			"  -budget: processing time budget per image in milliseconds\n"
+			"  -retry-degraded: process images that exceeded the budget again without\n"
+			"                   budget at the end of a directory\n"
+			"  -skip-checks: no SVM verification and symmetry check for chains of at\n"
+			"                least length digits read with this OCR confidence (0-100)\n"
+			"  -digits: read bib numbers with the digit classifier instead of Tesseract\n"
+			"  -crops: format of the bib and digit crops saved for training (png,\n"
+			"          default), or none\n"
+			"  -crop-level: PNG compression (0-9) or JPEG quality (0-100) of crops\n"
+			"  -crop-archive: append crops to this tar archive instead of writing\n"
+			"                 them to the current directory\n"
+			"  -prefetch: megabytes of image files read ahead of processing\n"
+			"             (default 64), 0 to read each file when it is processed\n"
+			"  -prescreen: skip JPEG images whose EXIF thumbnail has a lower edge\n"
+			"              density (0-1, e.g. 0.01)\n"
+			"  -no-debug-images: do not save the intermediate images of text\n"
+			"                    detection and recognition (canny.png, SWT*.png,\n"
+			"                    text-boxes.png, bib-*.png, face-detection.png...)\n"
+			"  -canny: edge thresholds of text detection (default 175 320)\n"
+			"  -color-dist: do not pair components whose mean colours are further\n"
+			"               apart (RGB distance, e.g. 77)\n"
+			"  -verify-hog: compare the specialised HOG kernel with cv::HOGDescriptor\n"
+			"  -train-digits: train the digit classifier (digits.xml) from the\n"
+			"                 digit-*.png images saved during Tesseract runs, or\n"
+			"                 from a crop archive\n\n"
 			<< endl;
 }
 
@@ -21,6 +73,9 @@ int main(int argc, const char** argv) {
 	string trainDir;
 	string svmModel;
 	int train = 0;
+	int compact = 0;
+	train::TrainParams trainParams;
+	pipeline::PipelineParams pipelineParams;
 
 	for (int i = 1; i < argc; i++) {
 		if (!strcmp(argv[i],"-train"))
@@ -34,6 +89,289 @@ int main(int argc, const char** argv) {
 			train = 1;
 			trainDir.assign(argv[++i]);
 		}
+		else if (!strcmp(argv[i],"-features"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -features" << endl;
+				help();
+				return -1;
+			}
+			trainParams.featureStore.assign(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-augment"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -augment" << endl;
+				help();
+				return -1;
+			}
+			trainParams.augmentations = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-hard-negatives"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -hard-negatives" << endl;
+				help();
+				return -1;
+			}
+			trainParams.hardNegativeRounds = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-solver"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -solver" << endl;
+				help();
+				return -1;
+			}
+			i++;
+			if (!strcmp(argv[i],"dcd"))
+				trainParams.solver = train::SOLVER_DCD;
+			else if (!strcmp(argv[i],"cvsvm"))
+				trainParams.solver = train::SOLVER_CVSVM;
+			else
+			{
+				cerr << "ERROR: unknown solver " << argv[i] << endl;
+				help();
+				return -1;
+			}
+		}
+		else if (!strcmp(argv[i],"-C"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -C" << endl;
+				help();
+				return -1;
+			}
+			/* comma separated list, cross-validated with -cv */
+			const char *c = argv[++i];
+			trainParams.Cs.clear();
+			while (*c) {
+				char *end;
+				trainParams.Cs.push_back(strtod(c, &end));
+				if ((end == c) || ((*end != ',') && (*end != '\0')))
+				{
+					cerr << "ERROR: invalid value for -C: " << argv[i] << endl;
+					return -1;
+				}
+				c = (*end == ',') ? end + 1 : end;
+			}
+			if (trainParams.Cs.empty())
+			{
+				cerr << "ERROR: missing parameter for -C" << endl;
+				return -1;
+			}
+			trainParams.C = trainParams.Cs[0];
+		}
+		else if (!strcmp(argv[i],"-cv"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -cv" << endl;
+				help();
+				return -1;
+			}
+			trainParams.folds = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-compare-solvers"))
+		{
+			trainParams.compareSolvers = true;
+		}
+		else if (!strcmp(argv[i],"-convert"))
+		{
+			if ( (i>=(argc-2)) )
+			{
+				cerr << "ERROR: missing parameters for -convert" << endl;
+				help();
+				return -1;
+			}
+			return (linearsvm::convert(argv[i+1], argv[i+2]) < 0) ? -1 : 0;
+		}
+		else if (!strcmp(argv[i],"-verify-hog"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -verify-hog" << endl;
+				help();
+				return -1;
+			}
+			return (fasthog::verify(argv[i+1]) < 0) ? -1 : 0;
+		}
+		else if (!strcmp(argv[i],"-train-digits"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -train-digits" << endl;
+				help();
+				return -1;
+			}
+			return (digitclassifier::train(argv[i+1], trainParams.C,
+					"digits.xml") < 0) ? -1 : 0;
+		}
+		else if (!strcmp(argv[i],"-ocr"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -ocr" << endl;
+				help();
+				return -1;
+			}
+			i++;
+			if (!strcmp(argv[i],"chain"))
+				pipelineParams.ocrMode = textrecognition::OCR_CHAIN;
+			else if (!strcmp(argv[i],"page"))
+				pipelineParams.ocrMode = textrecognition::OCR_PAGE;
+			else
+			{
+				cerr << "ERROR: unknown OCR mode " << argv[i] << endl;
+				help();
+				return -1;
+			}
+		}
+		else if (!strcmp(argv[i],"-ocr-budget"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -ocr-budget" << endl;
+				help();
+				return -1;
+			}
+			pipelineParams.maxOcrChains = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-budget"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -budget" << endl;
+				help();
+				return -1;
+			}
+			pipelineParams.imageBudget = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-retry-degraded"))
+		{
+			pipelineParams.retryDegraded = true;
+		}
+		else if (!strcmp(argv[i],"-skip-checks"))
+		{
+			if ( (i>=(argc-2)) )
+			{
+				cerr << "ERROR: missing parameters for -skip-checks" << endl;
+				help();
+				return -1;
+			}
+			pipelineParams.skipChecksConfidence = atof(argv[++i]);
+			pipelineParams.skipChecksMinLength = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-digits"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -digits" << endl;
+				help();
+				return -1;
+			}
+			pipelineParams.digitModel.assign(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-crops"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -crops" << endl;
+				help();
+				return -1;
+			}
+			i++;
+			if (!strcmp(argv[i],"png"))
+				pipelineParams.crops.format = cropwriter::FORMAT_PNG;
+			else if (!strcmp(argv[i],"jpg"))
+				pipelineParams.crops.format = cropwriter::FORMAT_JPEG;
+			else if (!strcmp(argv[i],"none"))
+				pipelineParams.crops.format = cropwriter::FORMAT_NONE;
+			else
+			{
+				cerr << "ERROR: unknown crop format " << argv[i] << endl;
+				help();
+				return -1;
+			}
+		}
+		else if (!strcmp(argv[i],"-crop-level"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -crop-level" << endl;
+				help();
+				return -1;
+			}
+			pipelineParams.crops.level = atoi(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-crop-archive"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -crop-archive" << endl;
+				help();
+				return -1;
+			}
+			pipelineParams.crops.archive.assign(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-prefetch"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -prefetch" << endl;
+				help();
+				return -1;
+			}
+			pipelineParams.prefetchBytes = (size_t) (atof(argv[++i]) * (1 << 20));
+		}
+		else if (!strcmp(argv[i],"-prescreen"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -prescreen" << endl;
+				help();
+				return -1;
+			}
+			pipelineParams.prescreenDensity = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-no-debug-images"))
+		{
+			pipelineParams.debugImages = false;
+		}
+		else if (!strcmp(argv[i],"-canny"))
+		{
+			if ( (i>=(argc-2)) )
+			{
+				cerr << "ERROR: missing parameters for -canny" << endl;
+				help();
+				return -1;
+			}
+			pipelineParams.cannyLow = atof(argv[++i]);
+			pipelineParams.cannyHigh = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-color-dist"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -color-dist" << endl;
+				help();
+				return -1;
+			}
+			pipelineParams.maxColorDist = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i],"-compact"))
+		{
+			compact = 1;
+		}
+		else if (!strcmp(argv[i],"-v"))
+		{
+			biblog::set_log_mask(LOG_MASK | LOG_TRAIN);
+		}
 		else if (!strcmp(argv[i],"-model"))
 		{
 			if ( (i>=(argc-1)) )
@@ -44,25 +382,66 @@ int main(int argc, const char** argv) {
 			}
 			svmModel.assign(argv[++i]);
 		}
+		else if (!strcmp(argv[i],"-detect"))
+		{
+			if ( (i>=(argc-1)) )
+			{
+				cerr << "ERROR: missing parameter for -detect" << endl;
+				help();
+				return -1;
+			}
+			i++;
+			if (!strcmp(argv[i],"swt"))
+				pipelineParams.detectionMode = pipeline::DETECTION_SWT;
+			else if (!strcmp(argv[i],"hog"))
+				pipelineParams.detectionMode = pipeline::DETECTION_HOG;
+			else if (!strcmp(argv[i],"both"))
+				pipelineParams.detectionMode = pipeline::DETECTION_SWT_HOG;
+			else
+			{
+				cerr << "ERROR: unknown detection mode " << argv[i] << endl;
+				help();
+				return -1;
+			}
+		}
 		else
 		{
 			inputName.assign(argv[i]);
 		}
 	}
 
+	if (compact)
+	{
+		if (trainParams.featureStore.empty())
+		{
+			cerr << "ERROR: -compact requires -features" << endl;
+			help();
+			return -1;
+		}
+		return featurestore::compact(trainParams.featureStore);
+	}
+
 	if ((inputName.empty()) || (!inputName.size())) {
 		cerr << "ERROR: Missing parameter" << endl;
 		help();
 		return -1;
 	}
 
+	if ((pipelineParams.detectionMode != pipeline::DETECTION_SWT) && svmModel.empty())
+	{
+		cerr << "ERROR: -detect hog|both requires -model" << endl;
+		help();
+		return -1;
+	}
+
 	if (train)
 	{
-		train::process(trainDir, inputName);
+		train::process(trainDir, inputName, trainParams);
 	}
 	else
 	{
-		batch::process(inputName, svmModel);
+		pipelineParams.svmModel = svmModel;
+		batch::process(inputName, pipelineParams);
 	}
 
 	return 0;
@@ -0,0 +1,164 @@
+#include <iostream>
+#include <sstream>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+
+#include "opencv2/highgui/highgui.hpp"
+
+#include "cropwriter.h"
+#include "batch.h"
+#include "log.h"
+
+namespace fs = boost::filesystem;
+
+/* metadata of the crops written to the current directory */
+#define CROP_INDEX_FILE "crops.csv"
+
+/* source;bib;x;y;width;height;angle */
+static std::string formatInfo(const struct cropwriter::CropInfo& info) {
+	std::ostringstream s;
+	s << info.source << ";" << info.text << ";" << info.box.x << ";"
+			<< info.box.y << ";" << info.box.width << ";" << info.box.height
+			<< ";" << info.angle;
+	return s.str();
+}
+
+namespace cropwriter {
+
+CropWriter::CropWriter(void) :
+		started(false), closing(false) {
+}
+
+CropWriter::~CropWriter(void) {
+	close();
+}
+
+void CropWriter::setParams(const struct CropWriterParams& _params) {
+	params = _params;
+	if (params.queueSize == 0)
+		params.queueSize = 1;
+}
+
+int CropWriter::start(void) {
+	if (!params.archive.empty()) {
+		if (archive.open(params.archive) < 0)
+			return -1;
+	} else {
+		index.open(CROP_INDEX_FILE, std::ios::out | std::ios::app);
+		if (!index.is_open()) {
+			std::cerr << "ERROR: Could not open " << CROP_INDEX_FILE
+					<< std::endl;
+			return -1;
+		}
+	}
+	thread = boost::thread(&CropWriter::run, this);
+	started = true;
+	return 0;
+}
+
+void CropWriter::write(const std::string& stem, const cv::Mat& crop,
+		const struct CropInfo& info) {
+	struct Item item;
+
+	if (params.format == FORMAT_NONE)
+		return;
+	/* crops are usually views of the image being processed */
+	item.name = stem + ((params.format == FORMAT_JPEG) ? ".jpg" : ".png");
+	item.crop = crop.clone();
+	item.info = info;
+
+	boost::mutex::scoped_lock lock(mutex);
+	if (!started && (start() < 0)) {
+		std::cerr << "ERROR: Could not start crop writer, crops not saved"
+				<< std::endl;
+		params.format = FORMAT_NONE;
+		return;
+	}
+	while (queue.size() >= params.queueSize)
+		notFull.wait(lock);
+	queue.push_back(item);
+	notEmpty.notify_one();
+}
+
+void CropWriter::close(void) {
+	{
+		boost::mutex::scoped_lock lock(mutex);
+		if (!started)
+			return;
+		closing = true;
+		notEmpty.notify_all();
+	}
+	thread.join();
+	archive.close();
+	if (index.is_open())
+		index.close();
+	started = false;
+	closing = false;
+}
+
+void CropWriter::run(void) {
+	for (;;) {
+		struct Item item;
+		{
+			boost::mutex::scoped_lock lock(mutex);
+			while (queue.empty() && !closing)
+				notEmpty.wait(lock);
+			if (queue.empty())
+				break;
+			item = queue.front();
+			queue.pop_front();
+			notFull.notify_one();
+		}
+		save(item);
+	}
+}
+
+int CropWriter::save(const struct Item& item) {
+	std::vector<int> flags;
+	if (params.level >= 0) {
+		flags.push_back(
+				(params.format == FORMAT_JPEG) ?
+						CV_IMWRITE_JPEG_QUALITY : CV_IMWRITE_PNG_COMPRESSION);
+		flags.push_back(params.level);
+	}
+
+	if (!archive.isOpen()) {
+		if (!cv::imwrite(item.name, item.crop, flags)) {
+			std::cerr << "ERROR: Could not write " << item.name << std::endl;
+			return -1;
+		}
+		index << item.name << ";" << formatInfo(item.info) << std::endl;
+		return 0;
+	}
+
+	std::vector<uchar> buf;
+	if (!cv::imencode(fs::path(item.name).extension().string(), item.crop,
+			buf, flags) || buf.empty()) {
+		std::cerr << "ERROR: Could not encode " << item.name << std::endl;
+		return -1;
+	}
+	return archive.append(item.name, &buf[0], buf.size(),
+			formatInfo(item.info));
+}
+
+int readArchive(std::string path, std::string prefix,
+		std::vector<struct tar::Entry>& entries) {
+	tar::TarReader reader;
+	struct tar::Entry entry;
+	int res;
+
+	if (reader.open(path) < 0)
+		return -1;
+	while ((res = reader.next(entry)) > 0) {
+		std::string name = fs::path(entry.name).filename().string();
+		if (batch::isImageFile(name)
+				&& boost::algorithm::starts_with(name, prefix))
+			entries.push_back(entry);
+	}
+	LOGL(LOG_TRAIN,
+			"Read " << entries.size() << " " << prefix << "* images from " << path);
+	return res;
+}
+
+} /* namespace cropwriter */
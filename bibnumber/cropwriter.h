@@ -0,0 +1,94 @@
+#ifndef CROPWRITER_H
+#define CROPWRITER_H
+
+#include <deque>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "tar.h"
+
+namespace cropwriter
+{
+	enum Format {
+		FORMAT_NONE, /* crops are not saved */
+		FORMAT_PNG,
+		FORMAT_JPEG
+	};
+
+	struct CropWriterParams {
+		CropWriterParams() :
+				format(FORMAT_PNG), level(-1), queueSize(64) {
+		}
+		enum Format format;
+		int level; /* PNG compression (0-9) or JPEG quality (0-100), -1 for default */
+		std::string archive; /* tar archive to append to, empty for one file per crop */
+		unsigned int queueSize; /* crops waiting to be written before write() blocks */
+	};
+
+	/* where a crop comes from, saved along with it */
+	struct CropInfo {
+		std::string source; /* image file */
+		std::string text; /* bib number read */
+		cv::Rect box; /* bib in the source image */
+		float angle; /* of the chain, in degrees */
+	};
+
+	/**
+	 * Saves bib and digit crops from a background thread, so that PNG/JPEG
+	 * encoding and file system writes do not hold up recognition. Crops are
+	 * either written to the current directory, with their metadata appended
+	 * to crops.csv, or appended to a tar archive with their metadata in a
+	 * pax comment record.
+	 */
+	class CropWriter {
+	public:
+		CropWriter(void);
+		~CropWriter(void);
+		/* before the first crop is written */
+		void setParams(const struct CropWriterParams& params);
+		/**
+		 * Queue a copy of crop, to be saved as <stem>.png or <stem>.jpg. The
+		 * writer thread is started on the first call. Blocks while the queue
+		 * is full.
+		 */
+		void write(const std::string& stem, const cv::Mat& crop,
+				const struct CropInfo& info);
+		/* write out queued crops and stop the writer thread */
+		void close(void);
+	private:
+		struct Item {
+			std::string name;
+			cv::Mat crop;
+			struct CropInfo info;
+		};
+		int start(void);
+		void run(void);
+		int save(const struct Item& item);
+
+		struct CropWriterParams params;
+		boost::thread thread;
+		boost::mutex mutex;
+		boost::condition_variable notEmpty, notFull;
+		std::deque<struct Item> queue;
+		bool started;
+		bool closing;
+		tar::TarWriter archive;
+		std::ofstream index; /* crops.csv, when not writing to an archive */
+	};
+
+	/**
+	 * Read the image entries of an archive whose file name starts with
+	 * prefix, e.g. "bib-" or "digit-"
+	 */
+	int readArchive(std::string path, std::string prefix,
+			std::vector<struct tar::Entry>& entries);
+}
+
+#endif /* #ifndef CROPWRITER_H */
@@ -0,0 +1,48 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include "opencv2/core/core.hpp"
+
+namespace deadline
+{
+	/**
+	 * Time budget of one image, checked at stage boundaries and in long
+	 * loops. Past half of the budget optional checks are skipped, past the
+	 * budget no new work is started and partial results are returned.
+	 * Either marks the result as degraded.
+	 */
+	class Deadline {
+	public:
+		Deadline(void) :
+				soft(0), hard(0), degraded(false) {
+		}
+		/* start a budget of budgetMs milliseconds, 0 for none */
+		void start(double budgetMs) {
+			int64 now = cv::getTickCount();
+			degraded = false;
+			if (budgetMs <= 0) {
+				soft = hard = 0;
+				return;
+			}
+			hard = now + (int64) (budgetMs * cv::getTickFrequency() / 1000);
+			soft = now + (int64) (budgetMs * cv::getTickFrequency() / 2000);
+		}
+		/* past half of the budget: skip optional checks */
+		bool softExpired(void) const { return expired(soft); }
+		/* past the budget: return partial results */
+		bool expired(void) const { return expired(hard); }
+		bool isDegraded(void) const { return degraded; }
+	private:
+		bool expired(int64 limit) const {
+			if ((limit == 0) || (cv::getTickCount() < limit))
+				return false;
+			degraded = true;
+			return true;
+		}
+
+		int64 soft, hard; /* tick counts, 0 for no limit */
+		mutable bool degraded;
+	};
+}
+
+#endif /* #ifndef DEADLINE_H */
@@ -0,0 +1,292 @@
+#include <iostream>
+#include <algorithm>
+#include <cctype>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+
+#include "opencv2/highgui/highgui.hpp"
+
+#include "digitclassifier.h"
+#include "linearsvm.h"
+#include "batch.h"
+#include "cropwriter.h"
+#include "log.h"
+
+namespace fs = boost::filesystem;
+
+/**
+ * Center the component in a square and scale it to the digit image size,
+ * keeping its aspect ratio
+ */
+static void normalise(const cv::Mat& component, cv::Mat& digit) {
+	int side = std::max(component.cols, component.rows);
+	cv::Mat square = cv::Mat::zeros(side, side, CV_8UC1);
+	component.copyTo(
+			square(
+					cv::Rect((side - component.cols) / 2,
+							(side - component.rows) / 2, component.cols,
+							component.rows)));
+	const int size = digitclassifier::DIGIT_SIZE
+			- 2 * digitclassifier::DIGIT_MARGIN;
+	digit = cv::Mat::zeros(digitclassifier::DIGIT_SIZE,
+			digitclassifier::DIGIT_SIZE, CV_8UC1);
+	cv::resize(square,
+			digit(
+					cv::Rect(digitclassifier::DIGIT_MARGIN,
+							digitclassifier::DIGIT_MARGIN, size, size)),
+			cv::Size(size, size), 0, 0, cv::INTER_AREA);
+}
+
+/**
+ * Compute the features of digit image files, or of the corresponding
+ * archive entries if any, into the rows of data, with the digit from the
+ * file name in labels (-1 if the file could not be read)
+ */
+class DigitFeatureInvoker: public cv::ParallelLoopBody {
+public:
+	DigitFeatureInvoker(const std::vector<fs::path>& _files,
+			const std::vector<struct tar::Entry>& _entries,
+			const digitclassifier::DigitClassifier& _classifier,
+			cv::Mat& _data, std::vector<int>& _labels) :
+			files(_files), entries(_entries), classifier(_classifier), data(
+					_data), labels(_labels) {
+	}
+
+	virtual void operator()(const cv::Range& range) const {
+		for (int i = range.start; i < range.end; i++) {
+			cv::Mat component =
+					entries.empty() ?
+							cv::imread(files[i].string(), 0) :
+							cv::imdecode(entries[i].data, 0);
+			std::string stem = files[i].stem().string();
+			if (component.empty()) {
+				std::cerr << "ERROR: Could not read " << files[i].string()
+						<< std::endl;
+				labels[i] = -1;
+				data.row(i) = cv::Scalar(0);
+				continue;
+			}
+			labels[i] = stem[stem.size() - 1] - '0';
+			classifier.features(component, data.ptr<float>(i));
+		}
+	}
+
+private:
+	const std::vector<fs::path>& files;
+	const std::vector<struct tar::Entry>& entries;
+	const digitclassifier::DigitClassifier& classifier;
+	cv::Mat& data;
+	std::vector<int>& labels;
+};
+
+/**
+ * Train one digit against all others per iteration into the
+ * corresponding row of weights and column of biases
+ */
+class OneVsRestInvoker: public cv::ParallelLoopBody {
+public:
+	OneVsRestInvoker(const cv::Mat& _data, const std::vector<int>& _labels,
+			double _C, cv::Mat& _weights, cv::Mat& _biases) :
+			data(_data), labels(_labels), C(_C), weights(_weights), biases(
+					_biases) {
+	}
+
+	virtual void operator()(const cv::Range& range) const {
+		for (int k = range.start; k < range.end; k++) {
+			struct linearsvm::SolverParams solverParams = {
+					C, /* C */
+					1000, /* max iterations */
+					0.1, /* tolerance */
+			};
+			std::vector<int> rows;
+			cv::Mat y(data.rows, 1, CV_32FC1);
+			linearsvm::LinearModel model;
+
+			for (int i = 0; i < data.rows; i++) {
+				y.at<float>(i, 0) = (labels[i] == k) ? 1.0 : -1.0;
+				if (labels[i] >= 0)
+					rows.push_back(i);
+			}
+			if (model.train(data, y, solverParams, rows) < 0)
+				continue;
+			std::copy(model.getWeights(), model.getWeights() + model.getSize(),
+					weights.ptr<float>(k));
+			biases.at<float>(0, k) = model.bias;
+		}
+	}
+
+private:
+	const cv::Mat& data;
+	const std::vector<int>& labels;
+	double C;
+	cv::Mat& weights;
+	cv::Mat& biases;
+};
+
+namespace digitclassifier {
+
+DigitClassifier::DigitClassifier(void) :
+		hog(cv::Size(DIGIT_SIZE, DIGIT_SIZE), cv::Size(10, 10), cv::Size(5, 5),
+				cv::Size(5, 5), 9) {
+}
+
+void DigitClassifier::features(const cv::Mat& component,
+		float* descriptor) const {
+	std::vector<float> values;
+	cv::Mat digit;
+
+	if (component.empty()) {
+		std::fill(descriptor, descriptor + getFeatureSize(), 0.0f);
+		return;
+	}
+	normalise(component, digit);
+	hog.compute(digit, values);
+	std::copy(values.begin(), values.end(), descriptor);
+}
+
+void DigitClassifier::classify(const std::vector<cv::Mat>& digits,
+		std::string& text, std::vector<float>& scores) const {
+	text.clear();
+	scores.clear();
+	if (digits.empty())
+		return;
+
+	cv::Mat data(digits.size(), getFeatureSize(), CV_32FC1);
+	for (unsigned int i = 0; i < digits.size(); i++)
+		features(digits[i], data.ptr<float>(i));
+
+	/* one row of class scores per digit image */
+	cv::Mat classScores;
+	cv::gemm(data, weights, 1.0, cv::repeat(biases, data.rows, 1), 1.0,
+			classScores, cv::GEMM_2_T);
+
+	for (int i = 0; i < classScores.rows; i++) {
+		cv::Point best;
+		double maxScore;
+		cv::minMaxLoc(classScores.row(i), 0, &maxScore, 0, &best);
+		text.push_back('0' + best.x);
+		scores.push_back(maxScore);
+	}
+}
+
+int DigitClassifier::save(std::string filename) const {
+	cv::FileStorage storage(filename, cv::FileStorage::WRITE);
+	if (!storage.isOpened()) {
+		std::cerr << "ERROR: Could not write " << filename << std::endl;
+		return -1;
+	}
+	storage << "digit_classifier" << "{";
+	storage << "weights" << weights;
+	storage << "biases" << biases;
+	storage << "}";
+	return 0;
+}
+
+int DigitClassifier::load(std::string filename) {
+	cv::FileStorage storage(filename, cv::FileStorage::READ);
+	if (!storage.isOpened()) {
+		std::cerr << "ERROR: Could not read " << filename << std::endl;
+		return -1;
+	}
+	cv::FileNode node = storage["digit_classifier"];
+	cv::Mat w, b;
+	if (!node.empty()) {
+		node["weights"] >> w;
+		node["biases"] >> b;
+	}
+	if ((w.rows != NDIGITS) || (w.cols != getFeatureSize())
+			|| (w.type() != CV_32FC1) || (b.total() != NDIGITS)
+			|| (b.type() != CV_32FC1)) {
+		std::cerr << "ERROR: Not a digit classifier model: " << filename
+				<< std::endl;
+		return -1;
+	}
+	weights = w;
+	biases = b.reshape(1, 1);
+	return 0;
+}
+
+int train(std::string dir, double C, std::string modelFile) {
+	DigitClassifier classifier;
+	std::vector<fs::path> files;
+	std::vector<struct tar::Entry> entries; /* if read from a crop archive */
+
+	if (tar::isArchive(dir)) {
+		std::vector<struct tar::Entry> digitEntries;
+		if (cropwriter::readArchive(dir, "digit-", digitEntries) < 0)
+			return -1;
+		for (unsigned int i = 0; i < digitEntries.size(); i++) {
+			std::string stem = fs::path(digitEntries[i].name).stem().string();
+			if (std::isdigit(stem[stem.size() - 1])) {
+				files.push_back(fs::path(dir) / digitEntries[i].name);
+				entries.push_back(digitEntries[i]);
+			}
+		}
+	} else if (!fs::is_directory(dir)) {
+		std::cerr << "ERROR: Not a directory: " << dir << std::endl;
+		return -1;
+	} else {
+		/* digit-<sequence id>-<digit>.png */
+		std::vector<fs::path> imgFiles = batch::getImageFiles(dir);
+		for (unsigned int i = 0; i < imgFiles.size(); i++) {
+			std::string stem = imgFiles[i].stem().string();
+			if (boost::starts_with(stem, "digit-")
+					&& std::isdigit(stem[stem.size() - 1]))
+				files.push_back(imgFiles[i]);
+		}
+	}
+	if (files.empty()) {
+		std::cerr << "ERROR: No digit images in " << dir << std::endl;
+		return -1;
+	}
+
+	cv::Mat data(files.size(), classifier.getFeatureSize(), CV_32FC1);
+	std::vector<int> labels(files.size());
+	cv::parallel_for_(cv::Range(0, files.size()),
+			DigitFeatureInvoker(files, entries, classifier, data, labels));
+
+	int count[NDIGITS] = { 0 };
+	for (unsigned int i = 0; i < labels.size(); i++) {
+		if (labels[i] >= 0)
+			count[labels[i]]++;
+	}
+	for (int k = 0; k < NDIGITS; k++) {
+		LOGL(LOG_TRAIN, "Digit " << k << ": " << count[k] << " examples");
+		if (count[k] == 0)
+			std::cout << "WARNING: no examples of digit " << k << std::endl;
+	}
+
+	int64 t = cv::getTickCount();
+	classifier.weights = cv::Mat::zeros(NDIGITS, classifier.getFeatureSize(),
+			CV_32FC1);
+	classifier.biases = cv::Mat::zeros(1, NDIGITS, CV_32FC1);
+	cv::parallel_for_(cv::Range(0, NDIGITS),
+			OneVsRestInvoker(data, labels, C, classifier.weights,
+					classifier.biases));
+	std::cout << "Trained digit classifier on " << files.size()
+			<< " examples in "
+			<< (cv::getTickCount() - t) / cv::getTickFrequency() << "s"
+			<< std::endl;
+
+	/* training set accuracy */
+	cv::Mat classScores;
+	cv::gemm(data, classifier.weights, 1.0,
+			cv::repeat(classifier.biases, data.rows, 1), 1.0, classScores,
+			cv::GEMM_2_T);
+	int correct = 0, total = 0;
+	for (int i = 0; i < classScores.rows; i++) {
+		cv::Point best;
+		if (labels[i] < 0)
+			continue;
+		cv::minMaxLoc(classScores.row(i), 0, 0, 0, &best);
+		total++;
+		if (best.x == labels[i])
+			correct++;
+	}
+	std::cout << "Training accuracy " << correct << "/" << total << std::endl;
+
+	return classifier.save(modelFile);
+}
+
+} /* namespace digitclassifier */
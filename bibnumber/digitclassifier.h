@@ -0,0 +1,55 @@
+#ifndef DIGITCLASSIFIER_H
+#define DIGITCLASSIFIER_H
+
+#include <string>
+#include <vector>
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/objdetect/objdetect.hpp"
+
+namespace digitclassifier
+{
+	enum {
+		NDIGITS = 10,
+		DIGIT_SIZE = 20, /* side of the normalised digit image */
+		DIGIT_MARGIN = 2 /* empty border around the digit */
+	};
+
+	/**
+	 * One-vs-rest linear classifier of single digits on HOG features.
+	 * Digits are binarised chain components (white strokes on black),
+	 * centered and scaled to DIGIT_SIZE x DIGIT_SIZE.
+	 */
+	class DigitClassifier {
+	public:
+		DigitClassifier(void);
+		/**
+		 * Classify all digit images with one matrix product
+		 * @param digits binarised CV_8UC1 component images
+		 * @param text one character per digit image
+		 * @param scores score of the selected class for each digit image
+		 */
+		void classify(const std::vector<cv::Mat>& digits, std::string& text,
+				std::vector<float>& scores) const;
+		/* HOG descriptor of a normalised digit image, getFeatureSize() floats */
+		void features(const cv::Mat& digit, float* descriptor) const;
+		int getFeatureSize(void) const { return hog.getDescriptorSize(); }
+		int save(std::string filename) const;
+		int load(std::string filename);
+		bool empty(void) const { return weights.empty(); }
+
+		cv::Mat weights; /* one row per digit */
+		cv::Mat biases; /* one column per digit */
+	private:
+		cv::HOGDescriptor hog;
+	};
+
+	/**
+	 * Train from digit images named digit-<sequence id>-<digit>.png in
+	 * dir or in a crop archive, as saved from chains read by Tesseract, and
+	 * save the model
+	 */
+	int train(std::string dir, double C, std::string modelFile);
+}
+
+#endif /* #ifndef DIGITCLASSIFIER_H */
@@ -0,0 +1,159 @@
+#include <cstring>
+
+#include "opencv2/highgui/highgui.hpp"
+
+#include "exif.h"
+
+#define JPEG_SOI 0xd8
+#define JPEG_SOS 0xda
+#define JPEG_EOI 0xd9
+#define JPEG_APP1 0xe1
+
+#define TIFF_ORIENTATION 0x0112
+#define TIFF_THUMBNAIL_OFFSET 0x0201 /* JPEGInterchangeFormat */
+#define TIFF_THUMBNAIL_LENGTH 0x0202 /* JPEGInterchangeFormatLength */
+#define TIFF_IFD_ENTRY_SIZE 12
+
+/* TIFF structure inside the EXIF segment, in either byte order */
+class TiffReader {
+public:
+	TiffReader(const unsigned char *_base, size_t _size, bool _bigEndian) :
+			base(_base), size(_size), bigEndian(_bigEndian) {
+	}
+	bool valid(size_t offset, size_t len) const {
+		return (offset <= size) && (len <= size - offset);
+	}
+	unsigned int get16(size_t offset) const {
+		const unsigned char *p = base + offset;
+		return bigEndian ? ((p[0] << 8) | p[1]) : (p[0] | (p[1] << 8));
+	}
+	unsigned int get32(size_t offset) const {
+		return bigEndian ?
+				((get16(offset) << 16) | get16(offset + 2)) :
+				(get16(offset) | (get16(offset + 2) << 16));
+	}
+	/* value of a SHORT or LONG tag of the IFD at offset */
+	bool tag(size_t ifd, unsigned int id, unsigned int& value) const {
+		if (!valid(ifd, 2))
+			return false;
+		unsigned int count = get16(ifd);
+		for (unsigned int i = 0; i < count; i++) {
+			size_t entry = ifd + 2 + i * TIFF_IFD_ENTRY_SIZE;
+			if (!valid(entry, TIFF_IFD_ENTRY_SIZE))
+				return false;
+			if (get16(entry) != id)
+				continue;
+			/* SHORT values are left-justified in the value field */
+			value = (get16(entry + 2) == 3) ? get16(entry + 8) : get32(entry + 8);
+			return true;
+		}
+		return false;
+	}
+	/* offset of the IFD following the one at offset, 0 if none */
+	size_t nextIfd(size_t ifd) const {
+		if (!valid(ifd, 2))
+			return 0;
+		size_t next = ifd + 2 + get16(ifd) * TIFF_IFD_ENTRY_SIZE;
+		return valid(next, 4) ? get32(next) : 0;
+	}
+private:
+	const unsigned char *base;
+	size_t size;
+	bool bigEndian;
+};
+
+/* not in place: the transposed image has another size */
+static void transpose(cv::Mat& img) {
+	cv::Mat transposed;
+	cv::transpose(img, transposed);
+	img = transposed;
+}
+
+namespace exif {
+
+int parse(const std::vector<unsigned char>& data, struct ExifInfo& info) {
+	info.orientation = 1;
+	info.thumbnailOffset = 0;
+	info.thumbnailLength = 0;
+
+	if ((data.size() < 4) || (data[0] != 0xff) || (data[1] != JPEG_SOI))
+		return -1;
+
+	/* marker segments up to the image data */
+	size_t pos = 2;
+	while ((pos + 4 <= data.size()) && (data[pos] == 0xff)) {
+		unsigned char marker = data[pos + 1];
+		size_t len = (data[pos + 2] << 8) | data[pos + 3];
+		if ((marker == JPEG_SOS) || (marker == JPEG_EOI) || (len < 2)
+				|| (pos + 2 + len > data.size()))
+			break;
+		const unsigned char *segment = &data[pos + 4];
+		if ((marker == JPEG_APP1) && (len >= 2 + 6 + 8)
+				&& !memcmp(segment, "Exif\0\0", 6)) {
+			/* offsets are relative to the TIFF header */
+			const unsigned char *tiff = segment + 6;
+			size_t tiffSize = len - 2 - 6;
+			TiffReader reader(tiff, tiffSize, tiff[0] == 'M');
+			size_t ifd0 = reader.get32(4);
+			unsigned int value;
+
+			if (reader.tag(ifd0, TIFF_ORIENTATION, value) && (value >= 1)
+					&& (value <= 8))
+				info.orientation = value;
+			size_t ifd1 = reader.nextIfd(ifd0);
+			unsigned int offset, length;
+			if (ifd1 && reader.tag(ifd1, TIFF_THUMBNAIL_OFFSET, offset)
+					&& reader.tag(ifd1, TIFF_THUMBNAIL_LENGTH, length)
+					&& reader.valid(offset, length)) {
+				info.thumbnailOffset = (tiff - &data[0]) + offset;
+				info.thumbnailLength = length;
+			}
+			return 0;
+		}
+		pos += 2 + len;
+	}
+	return -1;
+}
+
+cv::Mat thumbnail(const std::vector<unsigned char>& data,
+		const struct ExifInfo& info) {
+	if (info.thumbnailLength == 0)
+		return cv::Mat();
+	cv::Mat buf(1, info.thumbnailLength, CV_8UC1,
+			(void *) &data[info.thumbnailOffset]);
+	return cv::imdecode(buf, 1);
+}
+
+void orient(cv::Mat& img, int orientation) {
+	/* cases describe the stored image relative to the upright one */
+	switch (orientation) {
+	case 2: /* mirrored */
+		cv::flip(img, img, 1);
+		break;
+	case 3: /* upside down */
+		cv::flip(img, img, -1);
+		break;
+	case 4: /* mirrored upside down */
+		cv::flip(img, img, 0);
+		break;
+	case 5: /* mirrored, rotated 90 degrees counter-clockwise */
+		transpose(img);
+		break;
+	case 6: /* rotated 90 degrees counter-clockwise */
+		transpose(img);
+		cv::flip(img, img, 1);
+		break;
+	case 7: /* mirrored, rotated 90 degrees clockwise */
+		transpose(img);
+		cv::flip(img, img, -1);
+		break;
+	case 8: /* rotated 90 degrees clockwise */
+		transpose(img);
+		cv::flip(img, img, 0);
+		break;
+	default:
+		break;
+	}
+}
+
+} /* namespace exif */
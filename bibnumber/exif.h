@@ -0,0 +1,32 @@
+#ifndef EXIF_H
+#define EXIF_H
+
+#include <vector>
+
+#include "opencv2/imgproc/imgproc.hpp"
+
+namespace exif
+{
+	/* EXIF data used before processing a JPEG image */
+	struct ExifInfo {
+		int orientation; /* TIFF orientation (1-8), 1 if unknown */
+		size_t thumbnailOffset; /* of the embedded JPEG thumbnail in the file */
+		size_t thumbnailLength; /* 0 if there is none */
+	};
+
+	/**
+	 * Parse the EXIF segment of a JPEG file in memory
+	 * @return 0, -1 if there is none (info is then set to defaults)
+	 */
+	int parse(const std::vector<unsigned char>& data, struct ExifInfo& info);
+	/* decode the embedded thumbnail, an empty Mat if there is none */
+	cv::Mat thumbnail(const std::vector<unsigned char>& data,
+			const struct ExifInfo& info);
+	/**
+	 * Transpose/flip an image decoded without regard to its orientation, so
+	 * that it is upright
+	 */
+	void orient(cv::Mat& img, int orientation);
+}
+
+#endif /* #ifndef EXIF_H */
@@ -0,0 +1,549 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+#include <opencv/cv.h>
+#include <opencv/highgui.h>
+
+#include <boost/filesystem.hpp>
+
+#include "fasthog.h"
+#include "batch.h"
+
+/* cv::HOGDescriptor defaults */
+#define WIN_SIGMA ((BLOCK_SIZE + BLOCK_SIZE) / 8.0f)
+#define L2HYS_THRESHOLD 0.2f
+
+/* random windows compared per image by verify() */
+#define VERIFY_WINDOWS 10
+
+namespace fasthog {
+
+enum {
+	CELLS_PER_SIDE = BLOCK_SIZE / CELL_SIZE,
+	/* row histograms padded to a multiple of 4 floats */
+	ROW_HIST_STRIDE = (NBINS + 3) & ~3
+};
+
+/* cv::fastAtan2 polynomial, in degrees */
+static const float atan2_p1 = 0.9997878412794807f * (float) (180 / CV_PI);
+static const float atan2_p3 = -0.3258083974640975f * (float) (180 / CV_PI);
+static const float atan2_p5 = 0.1555786518463281f * (float) (180 / CV_PI);
+static const float atan2_p7 = -0.04432655554792128f * (float) (180 / CV_PI);
+
+/* orientation (degrees) to bin, in two steps as in cartToPolar + HOG */
+static const float degToRad = (float) (CV_PI / 180);
+static const float radToBin = (float) (NBINS / CV_PI);
+
+/**
+ * Per-pixel weights of a block. The Gaussian window is separable, so the
+ * weight of pixel (i, j) for cell (cx, cy) is y[cy][i] * x[cx][j], each
+ * factor being the Gaussian times the bilinear interpolation weight along
+ * one axis. Weights are non-zero in [begin, end) only.
+ */
+static const struct BlockWeights {
+	BlockWeights(void) {
+		const float scale = 1.f / (WIN_SIGMA * WIN_SIGMA * 2);
+
+		for (int c = 0; c < CELLS_PER_SIDE; c++) {
+			begin[c] = BLOCK_SIZE;
+			end[c] = 0;
+		}
+		for (int i = 0; i < BLOCK_SIZE; i++) {
+			float d = i - BLOCK_SIZE * 0.5f;
+			float gauss = std::exp(-d * d * scale);
+			float cell = (i + 0.5f) / CELL_SIZE - 0.5f;
+			int icell0 = cvFloor(cell);
+			cell -= icell0;
+
+			for (int c = 0; c < CELLS_PER_SIDE; c++) {
+				float w = (c == icell0) ? 1.f - cell :
+							(c == icell0 + 1) ? cell : 0.f;
+				x[c][i] = y[c][i] = gauss * w;
+				if (w != 0.f) {
+					begin[c] = std::min(begin[c], i);
+					end[c] = i + 1;
+				}
+			}
+		}
+	}
+
+	float x[CELLS_PER_SIDE][BLOCK_SIZE];
+	float y[CELLS_PER_SIDE][BLOCK_SIZE];
+	int begin[CELLS_PER_SIDE];
+	int end[CELLS_PER_SIDE];
+} blockWeights;
+
+static inline float fastAtan2(float y, float x) {
+	float ax = std::abs(x), ay = std::abs(y);
+	float a, c, c2;
+	if (ax >= ay) {
+		c = ay / (ax + (float) DBL_EPSILON);
+		c2 = c * c;
+		a = (((atan2_p7 * c2 + atan2_p5) * c2 + atan2_p3) * c2 + atan2_p1) * c;
+	} else {
+		c = ax / (ay + (float) DBL_EPSILON);
+		c2 = c * c;
+		a = 90.f
+				- (((atan2_p7 * c2 + atan2_p5) * c2 + atan2_p3) * c2 + atan2_p1)
+						* c;
+	}
+	if (x < 0)
+		a = 180.f - a;
+	if (y < 0)
+		a = 360.f - a;
+	return a;
+}
+
+/* L2-Hys block normalization */
+static inline void normalizeBlockHistogram(float* hist) {
+	float sum = 0;
+	for (int i = 0; i < BLOCK_HIST_SIZE; i++)
+		sum += hist[i] * hist[i];
+
+	float scale = 1.f / (std::sqrt(sum) + BLOCK_HIST_SIZE * 0.1f);
+	sum = 0;
+	for (int i = 0; i < BLOCK_HIST_SIZE; i++) {
+		hist[i] = std::min(hist[i] * scale, L2HYS_THRESHOLD);
+		sum += hist[i] * hist[i];
+	}
+
+	scale = 1.f / (std::sqrt(sum) + 1e-3f);
+	for (int i = 0; i < BLOCK_HIST_SIZE; i++)
+		hist[i] *= scale;
+}
+
+FastHOG::FastHOG(void) :
+		grad(WIN_WIDTH * WIN_HEIGHT * 2), qangle(WIN_WIDTH * WIN_HEIGHT * 2), dbuf(
+				WIN_WIDTH * 2), rowBuf((WIN_WIDTH + 2) * 3), colourDiffs(
+				WIN_WIDTH * 3 * 2), colourMags(WIN_WIDTH * 3), rowHist(
+				BLOCKS_X * CELLS_PER_SIDE * WIN_HEIGHT * ROW_HIST_STRIDE) {
+}
+
+cv::HOGDescriptor FastHOG::descriptor(void) {
+	return cv::HOGDescriptor(cv::Size(WIN_WIDTH, WIN_HEIGHT), /* windows size */
+	cv::Size(BLOCK_SIZE, BLOCK_SIZE), /* block size */
+	cv::Size(BLOCK_STRIDE, BLOCK_STRIDE), /* block stride */
+	cv::Size(CELL_SIZE, CELL_SIZE), /* cell size */
+	NBINS /* nbins */
+	);
+}
+
+/**
+ * Gradient magnitude split between the two nearest orientation bins, for
+ * every pixel of the window. Like cv::HOGDescriptor, the channel with the
+ * largest gradient is used for colour images and pixels outside the window
+ * are taken from the parent image, or reflected at its borders.
+ */
+void FastHOG::computeGradient(const cv::Mat& window) {
+	CV_Assert(
+			(window.cols == WIN_WIDTH) && (window.rows == WIN_HEIGHT) && ((window.type() == CV_8UC1) || (window.type() == CV_8UC3)));
+
+	const int cn = window.channels();
+	cv::Size wholeSize;
+	cv::Point ofs;
+	window.locateROI(wholeSize, ofs);
+
+	/* byte offsets of columns -1 and WIN_WIDTH */
+	const int left = (cv::borderInterpolate(ofs.x - 1, wholeSize.width,
+			cv::BORDER_REFLECT_101) - ofs.x) * cn;
+	const int right = (cv::borderInterpolate(ofs.x + WIN_WIDTH,
+			wholeSize.width, cv::BORDER_REFLECT_101) - ofs.x) * cn;
+
+	float* dx = &dbuf[0];
+	float* dy = &dbuf[WIN_WIDTH];
+	uchar* row = &rowBuf[0];
+
+	for (int y = 0; y < WIN_HEIGHT; y++) {
+		const uchar* imgPtr = window.data + y * window.step;
+		const uchar* prevPtr = window.data
+				+ (ptrdiff_t) (cv::borderInterpolate(y - 1 + ofs.y,
+						wholeSize.height, cv::BORDER_REFLECT_101) - ofs.y)
+						* (ptrdiff_t) window.step;
+		const uchar* nextPtr = window.data
+				+ (ptrdiff_t) (cv::borderInterpolate(y + 1 + ofs.y,
+						wholeSize.height, cv::BORDER_REFLECT_101) - ofs.y)
+						* (ptrdiff_t) window.step;
+
+		/* current row with its left and right neighbours */
+		std::copy(imgPtr + left, imgPtr + left + cn, row);
+		std::copy(imgPtr, imgPtr + WIN_WIDTH * cn, row + cn);
+		std::copy(imgPtr + right, imgPtr + right + cn,
+				row + (WIN_WIDTH + 1) * cn);
+
+		if (cn == 1) {
+#if CV_SSE2
+			const __m128i z = _mm_setzero_si128();
+			/* WIN_WIDTH is a multiple of 16 */
+			for (int x = 0; x < WIN_WIDTH; x += 16) {
+				__m128i r = _mm_loadu_si128((const __m128i *) (row + x + 2));
+				__m128i l = _mm_loadu_si128((const __m128i *) (row + x));
+				__m128i n = _mm_loadu_si128((const __m128i *) (nextPtr + x));
+				__m128i p = _mm_loadu_si128((const __m128i *) (prevPtr + x));
+				__m128i d[4];
+				d[0] = _mm_sub_epi16(_mm_unpacklo_epi8(r, z),
+						_mm_unpacklo_epi8(l, z));
+				d[1] = _mm_sub_epi16(_mm_unpackhi_epi8(r, z),
+						_mm_unpackhi_epi8(l, z));
+				d[2] = _mm_sub_epi16(_mm_unpacklo_epi8(n, z),
+						_mm_unpacklo_epi8(p, z));
+				d[3] = _mm_sub_epi16(_mm_unpackhi_epi8(n, z),
+						_mm_unpackhi_epi8(p, z));
+				for (int k = 0; k < 4; k++) {
+					/* sign extension to 32 bits */
+					__m128 lo = _mm_cvtepi32_ps(
+							_mm_srai_epi32(_mm_unpacklo_epi16(d[k], d[k]), 16));
+					__m128 hi = _mm_cvtepi32_ps(
+							_mm_srai_epi32(_mm_unpackhi_epi16(d[k], d[k]), 16));
+					float* dst = (k < 2 ? dx : dy) + x + (k & 1) * 8;
+					_mm_storeu_ps(dst, lo);
+					_mm_storeu_ps(dst + 4, hi);
+				}
+			}
+#else
+			for (int x = 0; x < WIN_WIDTH; x++) {
+				dx[x] = (float) (row[x + 2] - row[x]);
+				dy[x] = (float) (nextPtr[x] - prevPtr[x]);
+			}
+#endif
+		} else {
+			/* ties go to the lower channel, as the SSE2 path of OpenCV */
+#if CV_SSE2
+			/*
+			 * dx, dy of all channels at once on interleaved samples, with
+			 * dx^2 + dy^2 from a single multiply-add
+			 */
+			short* diffs = &colourDiffs[0];
+			int* mags = &colourMags[0];
+			const __m128i z = _mm_setzero_si128();
+			/* WIN_WIDTH * 3 is a multiple of 16 */
+			for (int k = 0; k < WIN_WIDTH * 3; k += 16) {
+				__m128i r = _mm_loadu_si128((const __m128i *) (row + k + 6));
+				__m128i l = _mm_loadu_si128((const __m128i *) (row + k));
+				__m128i n = _mm_loadu_si128((const __m128i *) (nextPtr + k));
+				__m128i p = _mm_loadu_si128((const __m128i *) (prevPtr + k));
+				__m128i d[2], e[2];
+				d[0] = _mm_sub_epi16(_mm_unpacklo_epi8(r, z),
+						_mm_unpacklo_epi8(l, z));
+				d[1] = _mm_sub_epi16(_mm_unpackhi_epi8(r, z),
+						_mm_unpackhi_epi8(l, z));
+				e[0] = _mm_sub_epi16(_mm_unpacklo_epi8(n, z),
+						_mm_unpacklo_epi8(p, z));
+				e[1] = _mm_sub_epi16(_mm_unpackhi_epi8(n, z),
+						_mm_unpackhi_epi8(p, z));
+				for (int h = 0; h < 2; h++) {
+					__m128i de0 = _mm_unpacklo_epi16(d[h], e[h]);
+					__m128i de1 = _mm_unpackhi_epi16(d[h], e[h]);
+					short* dst = diffs + (k + h * 8) * 2;
+					_mm_storeu_si128((__m128i *) dst, de0);
+					_mm_storeu_si128((__m128i *) (dst + 8), de1);
+					_mm_storeu_si128((__m128i *) (mags + k + h * 8),
+							_mm_madd_epi16(de0, de0));
+					_mm_storeu_si128((__m128i *) (mags + k + h * 8 + 4),
+							_mm_madd_epi16(de1, de1));
+				}
+			}
+			for (int x = 0; x < WIN_WIDTH; x++) {
+				int k = x * 3 + 2;
+				int mag0 = mags[k];
+				k = (mag0 <= mags[x * 3 + 1]) ? x * 3 + 1 : k;
+				mag0 = mags[k];
+				k = (mag0 <= mags[x * 3]) ? x * 3 : k;
+				dx[x] = (float) diffs[k * 2];
+				dy[x] = (float) diffs[k * 2 + 1];
+			}
+#else
+			for (int x = 0; x < WIN_WIDTH; x++) {
+				const uchar* p2 = row + (x + 2) * 3;
+				const uchar* p0 = row + x * 3;
+				const uchar* n = nextPtr + x * 3;
+				const uchar* p = prevPtr + x * 3;
+				float dx0, dy0, mag0, dxc, dyc, mag;
+
+				dx0 = (float) (p2[2] - p0[2]);
+				dy0 = (float) (n[2] - p[2]);
+				mag0 = dx0 * dx0 + dy0 * dy0;
+
+				dxc = (float) (p2[1] - p0[1]);
+				dyc = (float) (n[1] - p[1]);
+				mag = dxc * dxc + dyc * dyc;
+				if (mag0 <= mag) {
+					dx0 = dxc;
+					dy0 = dyc;
+					mag0 = mag;
+				}
+
+				dxc = (float) (p2[0] - p0[0]);
+				dyc = (float) (n[0] - p[0]);
+				mag = dxc * dxc + dyc * dyc;
+				if (mag0 <= mag) {
+					dx0 = dxc;
+					dy0 = dyc;
+				}
+				dx[x] = dx0;
+				dy[x] = dy0;
+			}
+#endif
+		}
+
+		float* gradPtr = &grad[y * WIN_WIDTH * 2];
+		uchar* qanglePtr = &qangle[y * WIN_WIDTH * 2];
+#if CV_SSE2
+		const __m128 eps = _mm_set1_ps((float) DBL_EPSILON);
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.f);
+		const __m128 half = _mm_set1_ps(0.5f);
+		const __m128 p1 = _mm_set1_ps(atan2_p1), p3 = _mm_set1_ps(atan2_p3);
+		const __m128 p5 = _mm_set1_ps(atan2_p5), p7 = _mm_set1_ps(atan2_p7);
+		const __m128 v90 = _mm_set1_ps(90.f), v180 = _mm_set1_ps(180.f);
+		const __m128 v360 = _mm_set1_ps(360.f);
+		const __m128 vDegToRad = _mm_set1_ps(degToRad);
+		const __m128 vRadToBin = _mm_set1_ps(radToBin);
+		const __m128i izero = _mm_setzero_si128();
+		const __m128i inbins = _mm_set1_epi32(NBINS);
+		const __m128i imaxbin = _mm_set1_epi32(NBINS - 1);
+		const __m128i ione = _mm_set1_epi32(1);
+
+		/* WIN_WIDTH is a multiple of 4 */
+		for (int x = 0; x < WIN_WIDTH; x += 4) {
+			__m128 vdx = _mm_loadu_ps(dx + x);
+			__m128 vdy = _mm_loadu_ps(dy + x);
+			__m128 mag = _mm_sqrt_ps(
+					_mm_add_ps(_mm_mul_ps(vdx, vdx), _mm_mul_ps(vdy, vdy)));
+
+			/* fastAtan2 */
+			__m128 ax = _mm_and_ps(vdx, absMask);
+			__m128 ay = _mm_and_ps(vdy, absMask);
+			__m128 c = _mm_div_ps(_mm_min_ps(ax, ay),
+					_mm_add_ps(_mm_max_ps(ax, ay), eps));
+			__m128 c2 = _mm_mul_ps(c, c);
+			__m128 a = _mm_add_ps(_mm_mul_ps(p7, c2), p5);
+			a = _mm_add_ps(_mm_mul_ps(a, c2), p3);
+			a = _mm_add_ps(_mm_mul_ps(a, c2), p1);
+			a = _mm_mul_ps(a, c);
+			__m128 mask = _mm_cmpge_ps(ax, ay);
+			a = _mm_or_ps(_mm_and_ps(mask, a),
+					_mm_andnot_ps(mask, _mm_sub_ps(v90, a)));
+			mask = _mm_cmplt_ps(vdx, zero);
+			a = _mm_or_ps(_mm_and_ps(mask, _mm_sub_ps(v180, a)),
+					_mm_andnot_ps(mask, a));
+			mask = _mm_cmplt_ps(vdy, zero);
+			a = _mm_or_ps(_mm_and_ps(mask, _mm_sub_ps(v360, a)),
+					_mm_andnot_ps(mask, a));
+
+			/* split between bins hidx and hidx + 1 */
+			__m128 angle = _mm_sub_ps(
+					_mm_mul_ps(_mm_mul_ps(a, vDegToRad), vRadToBin), half);
+			__m128i hidx = _mm_cvttps_epi32(angle);
+			/* truncation to floor */
+			hidx = _mm_add_epi32(hidx,
+					_mm_castps_si128(
+							_mm_cmpgt_ps(_mm_cvtepi32_ps(hidx), angle)));
+			angle = _mm_sub_ps(angle, _mm_cvtepi32_ps(hidx));
+
+			__m128 g0 = _mm_mul_ps(mag, _mm_sub_ps(one, angle));
+			__m128 g1 = _mm_mul_ps(mag, angle);
+			_mm_storeu_ps(gradPtr + x * 2, _mm_unpacklo_ps(g0, g1));
+			_mm_storeu_ps(gradPtr + x * 2 + 4, _mm_unpackhi_ps(g0, g1));
+
+			hidx = _mm_add_epi32(hidx,
+					_mm_and_si128(_mm_cmplt_epi32(hidx, izero), inbins));
+			hidx = _mm_sub_epi32(hidx,
+					_mm_and_si128(_mm_cmpgt_epi32(hidx, imaxbin), inbins));
+			__m128i hidx1 = _mm_add_epi32(hidx, ione);
+			hidx1 = _mm_andnot_si128(_mm_cmpgt_epi32(hidx1, imaxbin), hidx1);
+			/* interleave and pack the 8 bin indexes to bytes */
+			__m128i bins = _mm_packs_epi32(_mm_unpacklo_epi32(hidx, hidx1),
+					_mm_unpackhi_epi32(hidx, hidx1));
+			_mm_storel_epi64((__m128i *) (qanglePtr + x * 2),
+					_mm_packus_epi16(bins, bins));
+		}
+#else
+		for (int x = 0; x < WIN_WIDTH; x++) {
+			float mag = std::sqrt(dx[x] * dx[x] + dy[x] * dy[x]);
+			float angle = fastAtan2(dy[x], dx[x]) * degToRad * radToBin - 0.5f;
+			int hidx = cvFloor(angle);
+			angle -= hidx;
+			gradPtr[x * 2] = mag * (1.f - angle);
+			gradPtr[x * 2 + 1] = mag * angle;
+
+			if (hidx < 0)
+				hidx += NBINS;
+			else if (hidx >= NBINS)
+				hidx -= NBINS;
+			qanglePtr[x * 2] = (uchar) hidx;
+			hidx++;
+			qanglePtr[x * 2 + 1] = (uchar) (hidx < NBINS ? hidx : 0);
+		}
+#endif
+	}
+}
+
+void FastHOG::compute(const cv::Mat& window, float* descriptor) {
+	computeGradient(window);
+
+	/*
+	 * horizontal pass: histogram of each row of each block column, for both
+	 * cell columns of the block; shared by all the blocks of the column
+	 */
+	for (int y = 0; y < WIN_HEIGHT; y++) {
+		const float* gradPtr = &grad[y * WIN_WIDTH * 2];
+		const uchar* qanglePtr = &qangle[y * WIN_WIDTH * 2];
+
+		for (int bx = 0; bx < BLOCKS_X; bx++) {
+			for (int cx = 0; cx < CELLS_PER_SIDE; cx++) {
+				float* hist = &rowHist[((bx * CELLS_PER_SIDE + cx) * WIN_HEIGHT
+						+ y) * ROW_HIST_STRIDE];
+				std::fill(hist, hist + ROW_HIST_STRIDE, 0.f);
+
+				for (int j = blockWeights.begin[cx]; j < blockWeights.end[cx];
+						j++) {
+					int x = (bx * BLOCK_STRIDE + j) * 2;
+					float w = blockWeights.x[cx][j];
+					hist[qanglePtr[x]] += gradPtr[x] * w;
+					hist[qanglePtr[x + 1]] += gradPtr[x + 1] * w;
+				}
+			}
+		}
+	}
+
+	/* vertical pass: blocks column by column, as cv::HOGDescriptor */
+	for (int bx = 0; bx < BLOCKS_X; bx++) {
+		for (int by = 0; by < BLOCKS_Y; by++) {
+			float* hist = descriptor + (bx * BLOCKS_Y + by) * BLOCK_HIST_SIZE;
+
+			for (int cx = 0; cx < CELLS_PER_SIDE; cx++) {
+				for (int cy = 0; cy < CELLS_PER_SIDE; cy++) {
+					float* cell = hist + (cx * CELLS_PER_SIDE + cy) * NBINS;
+					const float* rowPtr = &rowHist[((bx * CELLS_PER_SIDE + cx)
+							* WIN_HEIGHT + by * BLOCK_STRIDE) * ROW_HIST_STRIDE];
+#if CV_SSE2
+					__m128 acc[ROW_HIST_STRIDE / 4];
+					for (int k = 0; k < ROW_HIST_STRIDE / 4; k++)
+						acc[k] = _mm_setzero_ps();
+					for (int i = blockWeights.begin[cy];
+							i < blockWeights.end[cy]; i++) {
+						const float* r = rowPtr + i * ROW_HIST_STRIDE;
+						__m128 w = _mm_set1_ps(blockWeights.y[cy][i]);
+						for (int k = 0; k < ROW_HIST_STRIDE / 4; k++)
+							acc[k] = _mm_add_ps(acc[k],
+									_mm_mul_ps(_mm_loadu_ps(r + k * 4), w));
+					}
+					float sum[ROW_HIST_STRIDE];
+					for (int k = 0; k < ROW_HIST_STRIDE / 4; k++)
+						_mm_storeu_ps(sum + k * 4, acc[k]);
+					std::copy(sum, sum + NBINS, cell);
+#else
+					float sum[NBINS] = { 0 };
+					for (int i = blockWeights.begin[cy];
+							i < blockWeights.end[cy]; i++) {
+						float w = blockWeights.y[cy][i];
+						for (int b = 0; b < NBINS; b++)
+							sum[b] += rowPtr[i * ROW_HIST_STRIDE + b] * w;
+					}
+					std::copy(sum, sum + NBINS, cell);
+#endif
+				}
+			}
+
+			normalizeBlockHistogram(hist);
+		}
+	}
+}
+
+void FastHOG::compute(const cv::Mat& img, std::vector<float>& descriptor) {
+	const cv::Mat* window = &img;
+
+	if ((img.cols != WIN_WIDTH) || (img.rows != WIN_HEIGHT)) {
+		/* resize to HOGDescriptor dimensions */
+		cv::resize(img, resized, cv::Size(WIN_WIDTH, WIN_HEIGHT), 0, 0);
+		window = &resized;
+	}
+
+	descriptor.resize(DESCRIPTOR_SIZE);
+	compute(*window, &descriptor[0]);
+}
+
+int verify(std::string inputName) {
+	std::vector<std::string> files;
+
+	if (boost::filesystem::is_directory(inputName)) {
+		std::vector<boost::filesystem::path> paths = batch::getImageFiles(
+				inputName);
+		for (unsigned int i = 0; i < paths.size(); i++)
+			files.push_back(paths[i].string());
+	} else {
+		files.push_back(inputName);
+	}
+
+	cv::HOGDescriptor hog = FastHOG::descriptor();
+	FastHOG fastHog;
+	cv::RNG rng(0);
+	std::vector<float> reference;
+	std::vector<float> descriptor(DESCRIPTOR_SIZE);
+	double maxDiff = 0, sumDiff = 0;
+	int64 tReference = 0, tFast = 0;
+	unsigned int nWindows = 0;
+
+	for (unsigned int i = 0; i < files.size(); i++) {
+		cv::Mat img = cv::imread(files[i], 1);
+		if (img.empty()) {
+			std::cerr << "ERROR: Failed to open " << files[i] << std::endl;
+			continue;
+		}
+
+		/* whole image resized, in colour and grayscale, and random windows */
+		std::vector<cv::Mat> windows(2);
+		cv::resize(img, windows[0], cv::Size(WIN_WIDTH, WIN_HEIGHT), 0, 0);
+		cv::cvtColor(windows[0], windows[1], CV_BGR2GRAY);
+		if ((img.cols > WIN_WIDTH) && (img.rows > WIN_HEIGHT)) {
+			for (int j = 0; j < VERIFY_WINDOWS; j++) {
+				int x = rng.uniform(0, img.cols - WIN_WIDTH);
+				int y = rng.uniform(0, img.rows - WIN_HEIGHT);
+				windows.push_back(
+						img(cv::Rect(x, y, WIN_WIDTH, WIN_HEIGHT)));
+			}
+		}
+
+		for (unsigned int j = 0; j < windows.size(); j++) {
+			int64 t = cv::getTickCount();
+			hog.compute(windows[j], reference);
+			tReference += cv::getTickCount() - t;
+
+			t = cv::getTickCount();
+			fastHog.compute(windows[j], &descriptor[0]);
+			tFast += cv::getTickCount() - t;
+
+			for (int k = 0; k < DESCRIPTOR_SIZE; k++) {
+				double diff = std::abs(reference[k] - descriptor[k]);
+				maxDiff = std::max(maxDiff, diff);
+				sumDiff += diff;
+			}
+			nWindows++;
+		}
+	}
+
+	if (nWindows == 0) {
+		std::cerr << "ERROR: No image to compare HOG descriptors" << std::endl;
+		return -1;
+	}
+
+	double meanDiff = sumDiff / ((double) nWindows * DESCRIPTOR_SIZE);
+	double ms = 1000. / (cv::getTickFrequency() * nWindows);
+	std::cout << "Compared " << nWindows << " windows: max difference "
+			<< maxDiff << ", mean difference " << meanDiff << std::endl;
+	std::cout << "cv::HOGDescriptor " << tReference * ms << "ms/window, FastHOG "
+			<< tFast * ms << "ms/window" << std::endl;
+
+	/* orientations on a bin boundary may fall either side, hence the mean */
+	if (meanDiff > 1e-4) {
+		std::cerr << "ERROR: FastHOG does not match cv::HOGDescriptor"
+				<< std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+} /* namespace fasthog */
@@ -0,0 +1,68 @@
+#ifndef FASTHOG_H
+#define FASTHOG_H
+
+#include <string>
+#include <vector>
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/objdetect/objdetect.hpp"
+
+namespace fasthog
+{
+	/* bib window geometry */
+	enum {
+		WIN_WIDTH = 128,
+		WIN_HEIGHT = 64,
+		BLOCK_SIZE = 16,
+		BLOCK_STRIDE = 8,
+		CELL_SIZE = 8,
+		NBINS = 9,
+		BLOCKS_X = (WIN_WIDTH - BLOCK_SIZE) / BLOCK_STRIDE + 1,
+		BLOCKS_Y = (WIN_HEIGHT - BLOCK_SIZE) / BLOCK_STRIDE + 1,
+		CELLS_PER_BLOCK = (BLOCK_SIZE / CELL_SIZE) * (BLOCK_SIZE / CELL_SIZE),
+		BLOCK_HIST_SIZE = CELLS_PER_BLOCK * NBINS,
+		DESCRIPTOR_SIZE = BLOCKS_X * BLOCKS_Y * BLOCK_HIST_SIZE
+	};
+
+	/**
+	 * HOG descriptor specialised for the bib window geometry, producing the
+	 * same descriptor layout as cv::HOGDescriptor (default Gaussian window,
+	 * L2-Hys, no gamma correction). Scratch buffers are kept between calls,
+	 * so use one instance per thread.
+	 */
+	class FastHOG {
+	public:
+		FastHOG(void);
+		/**
+		 * @param window WIN_WIDTH x WIN_HEIGHT CV_8UC1 or CV_8UC3 image, may
+		 * be a region of a larger image whose pixels are then used for the
+		 * gradients along the window borders
+		 * @param descriptor DESCRIPTOR_SIZE floats
+		 */
+		void compute(const cv::Mat& window, float* descriptor);
+		/* as above, img is resized to the window size first if needed */
+		void compute(const cv::Mat& img, std::vector<float>& descriptor);
+		/* equivalent cv::HOGDescriptor, e.g. for detection */
+		static cv::HOGDescriptor descriptor(void);
+	private:
+		void computeGradient(const cv::Mat& window);
+
+		std::vector<float> grad; /* two interpolated magnitudes per pixel */
+		std::vector<uchar> qangle; /* two orientation bins per pixel */
+		std::vector<float> dbuf; /* dx, dy of the current row */
+		std::vector<uchar> rowBuf; /* current row with its border pixels */
+		std::vector<short> colourDiffs; /* dx, dy of each channel */
+		std::vector<int> colourMags; /* dx^2 + dy^2 of each channel */
+		std::vector<float> rowHist; /* weighted histograms of block rows */
+		cv::Mat resized;
+	};
+
+	/**
+	 * Compare FastHOG with cv::HOGDescriptor on resized images and random
+	 * windows of an image file or of the images in a directory
+	 * @return 0 if the descriptors match, -1 otherwise
+	 */
+	int verify(std::string inputName);
+}
+
+#endif /* #ifndef FASTHOG_H */
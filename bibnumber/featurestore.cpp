@@ -0,0 +1,390 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "featurestore.h"
+
+namespace fs = boost::filesystem;
+
+#define STORE_DATA_FILE "features.dat"
+#define STORE_INDEX_FILE "index.txt"
+#define STORE_MAGIC "BHOG"
+#define STORE_VERSION 1
+
+/* data file header, keeps rows 16-byte aligned */
+struct StoreHeader {
+	char magic[4];
+	boost::uint32_t version;
+	boost::uint32_t cols;
+	boost::uint32_t reserved;
+};
+
+static std::string absolutePath(const fs::path& path) {
+	return fs::absolute(path).string();
+}
+
+static int writeHeader(FILE *f, unsigned int cols) {
+	struct StoreHeader header;
+	memcpy(header.magic, STORE_MAGIC, sizeof(header.magic));
+	header.version = STORE_VERSION;
+	header.cols = cols;
+	header.reserved = 0;
+	return (fwrite(&header, sizeof(header), 1, f) == 1) ? 0 : -1;
+}
+
+static int writeRows(FILE *f, const cv::Mat& rows) {
+	for (int i = 0; i < rows.rows; i++) {
+		if (fwrite(rows.ptr<float>(i), sizeof(float), rows.cols, f)
+				!= (size_t) rows.cols)
+			return -1;
+	}
+	return 0;
+}
+
+namespace featurestore {
+
+FeatureStore::FeatureStore() :
+		cols(0), rows(0), dataFile(NULL), mapAddr(NULL), mapLen(0) {
+}
+
+FeatureStore::~FeatureStore(void) {
+	close();
+}
+
+std::string FeatureStore::hogParams(const cv::HOGDescriptor& hog) const {
+	std::ostringstream s;
+	s << hog.winSize.width << "x" << hog.winSize.height << " "
+			<< hog.blockSize.width << "x" << hog.blockSize.height << " "
+			<< hog.blockStride.width << "x" << hog.blockStride.height << " "
+			<< hog.cellSize.width << "x" << hog.cellSize.height << " "
+			<< hog.nbins;
+	return s.str();
+}
+
+int FeatureStore::open(std::string _dir) {
+	boost::system::error_code ec;
+
+	close();
+	dir = _dir;
+
+	if (!fs::is_directory(dir)) {
+		fs::create_directories(dir, ec);
+		if (ec) {
+			std::cerr << "ERROR: Could not create feature store " << dir
+					<< std::endl;
+			return -1;
+		}
+	}
+
+	/* read index */
+	std::ifstream file((fs::path(dir) / STORE_INDEX_FILE).c_str());
+	std::string line;
+	while (std::getline(file, line)) {
+		std::stringstream lineStream(line);
+		std::string cell;
+		std::vector<std::string> cells;
+
+		if (line.empty() || (line[0] == '#'))
+			continue;
+
+		if (line.compare(0, 4, "hog;") == 0) {
+			while (std::getline(lineStream, cell, ';'))
+				cells.push_back(cell);
+			if (cells.size() == 3) {
+				hogDesc = cells[1];
+				cols = atoi(cells[2].c_str());
+			}
+			continue;
+		}
+
+		/* row;count;label;mtime;size;path - path may contain ';' */
+		Entry entry;
+		for (int i = 0; i < 5; i++) {
+			std::getline(lineStream, cell, ';');
+			cells.push_back(cell);
+		}
+		std::string path;
+		std::getline(lineStream, path);
+		if (path.empty())
+			continue;
+		entry.row = strtoul(cells[0].c_str(), NULL, 10);
+		entry.count = strtoul(cells[1].c_str(), NULL, 10);
+		entry.label = atoi(cells[2].c_str());
+		entry.mtime = (std::time_t) strtol(cells[3].c_str(), NULL, 10);
+		entry.size = strtoull(cells[4].c_str(), NULL, 10);
+		index[path] = entry;
+	}
+
+	return map();
+}
+
+int FeatureStore::map(void) {
+	fs::path dataPath = fs::path(dir) / STORE_DATA_FILE;
+	struct StoreHeader header;
+
+	rows = 0;
+	if (!fs::exists(dataPath))
+		return 0;
+
+	int fd = ::open(dataPath.c_str(), O_RDONLY);
+	if (fd < 0) {
+		std::cerr << "ERROR: Could not open " << dataPath.string() << std::endl;
+		return -1;
+	}
+	struct stat st;
+	if ((fstat(fd, &st) < 0) || ((size_t) st.st_size < sizeof(header))) {
+		::close(fd);
+		return 0;
+	}
+	mapLen = st.st_size;
+	mapAddr = mmap(NULL, mapLen, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (mapAddr == MAP_FAILED) {
+		std::cerr << "ERROR: Could not map " << dataPath.string() << std::endl;
+		mapAddr = NULL;
+		mapLen = 0;
+		return -1;
+	}
+
+	memcpy(&header, mapAddr, sizeof(header));
+	if ((memcmp(header.magic, STORE_MAGIC, sizeof(header.magic)))
+			|| (header.version != STORE_VERSION) || (header.cols != cols)
+			|| (cols == 0)) {
+		std::cerr << "ERROR: Invalid feature store data in " << dir
+				<< ", discarding" << std::endl;
+		unmap();
+		fs::remove(dataPath);
+		index.clear();
+		return 0;
+	}
+	rows = (mapLen - sizeof(header)) / (cols * sizeof(float));
+	return 0;
+}
+
+void FeatureStore::unmap(void) {
+	if (mapAddr)
+		munmap(mapAddr, mapLen);
+	mapAddr = NULL;
+	mapLen = 0;
+}
+
+void FeatureStore::close(void) {
+	if (dataFile)
+		fclose(dataFile);
+	dataFile = NULL;
+	unmap();
+	index.clear();
+	hogDesc.clear();
+	cols = 0;
+	rows = 0;
+}
+
+void FeatureStore::reset(const cv::HOGDescriptor& hog) {
+	std::string desc = hogParams(hog);
+
+	if ((desc == hogDesc) && (cols == hog.getDescriptorSize()))
+		return;
+
+	if (!index.empty()) {
+		std::cout << "HOG parameters changed (" << hogDesc << " -> " << desc
+				<< "), discarding " << index.size() << " cached entries"
+				<< std::endl;
+	}
+	if (dataFile)
+		fclose(dataFile);
+	dataFile = NULL;
+	unmap();
+	fs::remove(fs::path(dir) / STORE_DATA_FILE);
+	index.clear();
+	hogDesc = desc;
+	cols = hog.getDescriptorSize();
+	rows = 0;
+}
+
+bool FeatureStore::isUpToDate(const std::string& path,
+		const Entry& entry) const {
+	boost::system::error_code ec;
+
+	std::time_t mtime = fs::last_write_time(path, ec);
+	if (ec || (mtime != entry.mtime))
+		return false;
+	boost::uintmax_t size = fs::file_size(path, ec);
+	if (ec || (size != entry.size))
+		return false;
+	return true;
+}
+
+cv::Mat FeatureStore::lookup(const fs::path& source, int label,
+		unsigned int count) const {
+	std::map<std::string, Entry>::const_iterator it = index.find(
+			absolutePath(source));
+
+	if ((it == index.end()) || (it->second.label != label)
+			|| (it->second.count != count)
+			|| (!isUpToDate(it->first, it->second)))
+		return cv::Mat();
+
+	/* rows appended since the store was opened are not mapped */
+	size_t end = sizeof(struct StoreHeader)
+			+ (size_t) (it->second.row + count) * cols * sizeof(float);
+	if ((!mapAddr) || (end > mapLen))
+		return cv::Mat();
+
+	float *data = (float*) ((char*) mapAddr + sizeof(struct StoreHeader))
+			+ (size_t) it->second.row * cols;
+	return cv::Mat(count, cols, CV_32FC1, data);
+}
+
+int FeatureStore::append(const fs::path& source, int label,
+		const cv::Mat& descriptors) {
+	boost::system::error_code ec;
+	std::string path = absolutePath(source);
+
+	if ((cols == 0) || ((unsigned) descriptors.cols != cols)
+			|| (descriptors.type() != CV_32FC1))
+		return -1;
+
+	if (!dataFile) {
+		fs::path dataPath = fs::path(dir) / STORE_DATA_FILE;
+		dataFile = fopen(dataPath.c_str(), "ab");
+		if (!dataFile) {
+			std::cerr << "ERROR: Could not open " << dataPath.string()
+					<< std::endl;
+			return -1;
+		}
+		/* a fresh data file starts with its header */
+		if ((fs::file_size(dataPath, ec) == 0)
+				&& (writeHeader(dataFile, cols) < 0))
+			return -1;
+	}
+
+	if (writeRows(dataFile, descriptors) < 0) {
+		std::cerr << "ERROR: Could not write to feature store " << dir
+				<< std::endl;
+		return -1;
+	}
+
+	Entry entry;
+	entry.row = rows;
+	entry.count = descriptors.rows;
+	entry.label = label;
+	entry.mtime = fs::last_write_time(path, ec);
+	entry.size = fs::file_size(path, ec);
+	index[path] = entry;
+	rows += descriptors.rows;
+
+	return 0;
+}
+
+int FeatureStore::save(void) {
+	fs::path indexPath = fs::path(dir) / STORE_INDEX_FILE;
+	fs::path tmpPath = fs::path(dir) / STORE_INDEX_FILE ".tmp";
+
+	if (dataFile)
+		fflush(dataFile);
+
+	std::ofstream file(tmpPath.c_str());
+	file << "# bibnumber HOG feature store" << std::endl;
+	file << "hog;" << hogDesc << ";" << cols << std::endl;
+	for (std::map<std::string, Entry>::const_iterator it = index.begin();
+			it != index.end(); it++) {
+		file << it->second.row << ";" << it->second.count << ";"
+				<< it->second.label << ";" << (long) it->second.mtime << ";"
+				<< it->second.size << ";" << it->first << std::endl;
+	}
+	file.close();
+	if (!file) {
+		std::cerr << "ERROR: Could not write " << tmpPath.string() << std::endl;
+		return -1;
+	}
+
+	boost::system::error_code ec;
+	fs::rename(tmpPath, indexPath, ec);
+	return ec ? -1 : 0;
+}
+
+int FeatureStore::compact(void) {
+	fs::path dataPath = fs::path(dir) / STORE_DATA_FILE;
+	fs::path tmpPath = fs::path(dir) / STORE_DATA_FILE ".tmp";
+	std::map<std::string, Entry> newIndex;
+	unsigned int newRows = 0;
+	unsigned int oldRows;
+
+	/* make sure every appended row is visible in the mapping */
+	if (dataFile)
+		fclose(dataFile);
+	dataFile = NULL;
+	unmap();
+	if (map() < 0)
+		return -1;
+	oldRows = rows;
+
+	FILE *f = fopen(tmpPath.c_str(), "wb");
+	if ((!f) || (writeHeader(f, cols) < 0)) {
+		std::cerr << "ERROR: Could not write " << tmpPath.string() << std::endl;
+		if (f)
+			fclose(f);
+		return -1;
+	}
+
+	for (std::map<std::string, Entry>::const_iterator it = index.begin();
+			it != index.end(); it++) {
+		if ((!fs::exists(it->first)) || (!isUpToDate(it->first, it->second))
+				|| (it->second.row + it->second.count > rows)) {
+			std::cout << "Pruning " << it->first << std::endl;
+			continue;
+		}
+		float *data = (float*) ((char*) mapAddr + sizeof(struct StoreHeader))
+				+ (size_t) it->second.row * cols;
+		if (writeRows(f, cv::Mat(it->second.count, cols, CV_32FC1, data)) < 0) {
+			std::cerr << "ERROR: Could not write " << tmpPath.string()
+					<< std::endl;
+			fclose(f);
+			return -1;
+		}
+		Entry entry = it->second;
+		entry.row = newRows;
+		newIndex[it->first] = entry;
+		newRows += entry.count;
+	}
+	fclose(f);
+
+	std::cout << "Compacted feature store " << dir << ": kept "
+			<< newIndex.size() << "/" << index.size() << " entries, "
+			<< oldRows << " -> " << newRows << " rows" << std::endl;
+
+	unmap();
+	boost::system::error_code ec;
+	fs::rename(tmpPath, dataPath, ec);
+	if (ec) {
+		std::cerr << "ERROR: Could not replace " << dataPath.string()
+				<< std::endl;
+		return -1;
+	}
+	index = newIndex;
+	if (save() < 0)
+		return -1;
+	return map();
+}
+
+int compact(std::string dir) {
+	FeatureStore store;
+
+	if (!fs::is_directory(dir)) {
+		std::cerr << "ERROR: Not a feature store: " << dir << std::endl;
+		return -1;
+	}
+	if (store.open(dir) < 0)
+		return -1;
+	return store.compact();
+}
+
+} /* namespace featurestore */
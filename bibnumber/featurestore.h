@@ -0,0 +1,72 @@
+#ifndef FEATURESTORE_H
+#define FEATURESTORE_H
+
+#include <cstdio>
+#include <ctime>
+#include <map>
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/filesystem.hpp>
+
+#include "opencv2/objdetect/objdetect.hpp"
+
+namespace featurestore
+{
+	/* one indexed source file and the descriptor rows computed from it */
+	struct Entry {
+		unsigned int row; /* first row in data file */
+		unsigned int count; /* number of rows */
+		int label;
+		std::time_t mtime;
+		boost::uintmax_t size;
+	};
+
+	/**
+	 * On-disk cache of HOG descriptors. The store is a directory holding a
+	 * flat float matrix (features.dat, memory-mapped when opened) and a
+	 * text index (index.txt) of source file path, mtime/size and HOG
+	 * parameters. New rows are only ever appended; stale rows are
+	 * reclaimed by compact().
+	 */
+	class FeatureStore {
+	public:
+		FeatureStore(void);
+		~FeatureStore(void);
+		/* open store directory, creating it if needed */
+		int open(std::string dir);
+		void close(void);
+		/* drop all entries if they were computed with other HOG parameters */
+		void reset(const cv::HOGDescriptor& hog);
+		/* return cached rows of an up-to-date entry, or an empty Mat */
+		cv::Mat lookup(const boost::filesystem::path& source, int label,
+				unsigned int count) const;
+		/* append rows computed from source, replacing any previous entry */
+		int append(const boost::filesystem::path& source, int label,
+				const cv::Mat& descriptors);
+		/* write index to disk */
+		int save(void);
+		/* rewrite data file without stale rows and missing sources */
+		int compact(void);
+		unsigned int size(void) const { return index.size(); }
+	private:
+		int map(void);
+		void unmap(void);
+		bool isUpToDate(const std::string& path, const Entry& entry) const;
+		std::string hogParams(const cv::HOGDescriptor& hog) const;
+
+		std::string dir;
+		std::string hogDesc; /* HOG parameters the rows were computed with */
+		unsigned int cols;
+		unsigned int rows; /* rows in data file */
+		std::map<std::string, Entry> index;
+		FILE *dataFile; /* data file opened for appending */
+		void *mapAddr;
+		size_t mapLen;
+	};
+
+	/* prune and compact the store in dir */
+	int compact(std::string dir);
+}
+
+#endif /* #ifndef FEATURESTORE_H */
@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "opencv2/core/core.hpp"
+
+#include "imageloader.h"
+
+/* size of the read() calls */
+#define LOADER_CHUNK_SIZE (1 << 20)
+
+namespace imageloader {
+
+int readFile(std::string path, std::vector<unsigned char>& data,
+		double& seconds) {
+	int64 t = cv::getTickCount();
+	struct stat st;
+
+	data.clear();
+	seconds = 0;
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if ((fstat(fd, &st) < 0) || (st.st_size == 0)) {
+		close(fd);
+		return -1;
+	}
+#ifdef POSIX_FADV_SEQUENTIAL
+	/* whole file read once from start to end */
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+	data.resize(st.st_size);
+	size_t done = 0;
+	while (done < data.size()) {
+		size_t len = std::min((size_t) LOADER_CHUNK_SIZE, data.size() - done);
+		ssize_t n = read(fd, &data[done], len);
+		if ((n < 0) && (errno == EINTR))
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+#ifdef POSIX_FADV_DONTNEED
+	/* the contents are kept in memory until decoded */
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+	close(fd);
+	seconds = (cv::getTickCount() - t) / cv::getTickFrequency();
+	if (done < data.size()) {
+		data.clear();
+		return -1;
+	}
+	return 0;
+}
+
+ImageLoader::ImageLoader(size_t _byteBudget) :
+		byteBudget(_byteBudget), nextFile(0), wanted(NULL), queuedBytes(0), stopping(
+				false), done(true) {
+	stats.files = 0;
+	stats.bytes = 0;
+	stats.readSeconds = 0;
+	stats.waitSeconds = 0;
+}
+
+ImageLoader::~ImageLoader(void) {
+	stop();
+}
+
+void ImageLoader::start(const std::vector<std::string>& _files) {
+	stop();
+	files = _files;
+	nextFile = 0;
+	archivePath.clear();
+	done = false;
+	if (byteBudget > 0)
+		thread = boost::thread(&ImageLoader::run, this);
+}
+
+int ImageLoader::startArchive(std::string path,
+		bool (*_wanted)(std::string name)) {
+	stop();
+	files.clear();
+	nextFile = 0;
+	archivePath = path;
+	wanted = _wanted;
+	if ((zip::isArchive(path) ? zipReader.open(path) : tarReader.open(path))
+			< 0)
+		return -1;
+	done = false;
+	if (byteBudget > 0)
+		thread = boost::thread(&ImageLoader::run, this);
+	return 0;
+}
+
+void ImageLoader::stop(void) {
+	{
+		boost::mutex::scoped_lock lock(mutex);
+		stopping = true;
+		notFull.notify_all();
+	}
+	if (thread.joinable())
+		thread.join();
+	queue.clear();
+	queuedBytes = 0;
+	stopping = false;
+	done = true;
+	tarReader.close();
+	zipReader.close();
+	archivePath.clear();
+}
+
+int ImageLoader::readNext(struct Item& item) {
+	if (archivePath.empty()) {
+		if (nextFile >= files.size())
+			return 0;
+		item.name = files[nextFile++];
+		item.res = readFile(item.name, item.data, item.readSeconds);
+		return 1;
+	}
+
+	/* entries in the order they are stored, without seeking back */
+	struct tar::Entry entry;
+	int64 t = cv::getTickCount();
+	int res = zipReader.isOpen() ?
+			zipReader.next(entry, wanted) : tarReader.next(entry, true, wanted);
+	if (res <= 0)
+		return 0;
+	item.name = archivePath + "!" + entry.name;
+	item.data.swap(entry.data);
+	item.res = 0;
+	item.readSeconds = (cv::getTickCount() - t) / cv::getTickFrequency();
+	return 1;
+}
+
+void ImageLoader::run(void) {
+	for (;;) {
+		struct Item item;
+		{
+			boost::mutex::scoped_lock lock(mutex);
+			while ((queuedBytes >= byteBudget) && !queue.empty() && !stopping)
+				notFull.wait(lock);
+			if (stopping)
+				return;
+		}
+		int res = readNext(item);
+
+		boost::mutex::scoped_lock lock(mutex);
+		if (res == 0) {
+			done = true;
+			notEmpty.notify_one();
+			return;
+		}
+		queuedBytes += item.data.size();
+		queue.push_back(Item());
+		queue.back().name.swap(item.name);
+		queue.back().data.swap(item.data);
+		queue.back().res = item.res;
+		queue.back().readSeconds = item.readSeconds;
+		notEmpty.notify_one();
+	}
+}
+
+int ImageLoader::next(std::string& name, std::vector<unsigned char>& data,
+		struct LoadInfo& info) {
+	struct Item item;
+
+	int64 t = cv::getTickCount();
+	if (byteBudget == 0) {
+		if (done || (readNext(item) == 0)) {
+			done = true;
+			return 0;
+		}
+	} else {
+		boost::mutex::scoped_lock lock(mutex);
+		while (queue.empty() && !done)
+			notEmpty.wait(lock);
+		if (queue.empty())
+			return 0;
+		item.name.swap(queue.front().name);
+		item.data.swap(queue.front().data);
+		item.res = queue.front().res;
+		item.readSeconds = queue.front().readSeconds;
+		queue.pop_front();
+		queuedBytes -= item.data.size();
+		notFull.notify_one();
+	}
+	name.swap(item.name);
+	data.swap(item.data);
+	info.readSeconds = item.readSeconds;
+	info.waitSeconds = (cv::getTickCount() - t) / cv::getTickFrequency();
+	info.bytes = data.size();
+
+	stats.files++;
+	stats.bytes += info.bytes;
+	stats.readSeconds += info.readSeconds;
+	stats.waitSeconds += info.waitSeconds;
+	return (item.res < 0) ? -1 : 1;
+}
+
+} /* namespace imageloader */
@@ -0,0 +1,97 @@
+#ifndef IMAGELOADER_H
+#define IMAGELOADER_H
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "tar.h"
+#include "zip.h"
+
+namespace imageloader
+{
+	/* I/O of one file */
+	struct LoadInfo {
+		size_t bytes;
+		double readSeconds; /* spent reading the file */
+		double waitSeconds; /* the caller was blocked waiting for it */
+	};
+
+	/* accumulated over all files */
+	struct IoStats {
+		unsigned int files;
+		double bytes;
+		double readSeconds;
+		double waitSeconds;
+	};
+
+	/**
+	 * Read a whole file into memory in large sequential chunks, telling the
+	 * kernel to read ahead
+	 * @return 0, -1 on error
+	 */
+	int readFile(std::string path, std::vector<unsigned char>& data,
+			double& seconds);
+
+	/**
+	 * Reads files, or the entries of a tar or zip archive, ahead of
+	 * processing from a background thread, keeping at most byteBudget bytes
+	 * read but not yet returned by next() (and at least one file). With a
+	 * budget of 0 files are read by next().
+	 */
+	class ImageLoader {
+	public:
+		ImageLoader(size_t byteBudget);
+		~ImageLoader(void);
+		/* start reading files, in order */
+		void start(const std::vector<std::string>& files);
+		/**
+		 * Start reading the entries of a tar or zip archive accepted by
+		 * wanted, in the order they are stored. They are named
+		 * <archive>!<entry>.
+		 */
+		int startArchive(std::string path, bool (*wanted)(std::string name));
+		/**
+		 * Name and contents of the next file, waiting for it if needed
+		 * @return 1, 0 when all files were returned, -1 if the file could not
+		 * be read
+		 */
+		int next(std::string& name, std::vector<unsigned char>& data,
+				struct LoadInfo& info);
+		/* stop reading ahead */
+		void stop(void);
+		const struct IoStats& getStats(void) const { return stats; }
+	private:
+		struct Item {
+			std::string name;
+			std::vector<unsigned char> data;
+			int res;
+			double readSeconds;
+		};
+		void run(void);
+		/* read the next file or archive entry, 0 at the end */
+		int readNext(struct Item& item);
+
+		size_t byteBudget;
+		std::vector<std::string> files;
+		unsigned int nextFile; /* next file to read */
+		std::string archivePath;
+		tar::TarReader tarReader;
+		zip::ZipReader zipReader;
+		bool (*wanted)(std::string name);
+		boost::thread thread;
+		boost::mutex mutex;
+		boost::condition_variable notEmpty, notFull;
+		std::deque<struct Item> queue;
+		size_t queuedBytes;
+		bool stopping;
+		bool done; /* all files were read */
+		struct IoStats stats;
+	};
+}
+
+#endif /* #ifndef IMAGELOADER_H */
@@ -0,0 +1,441 @@
+#include <iostream>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/cstdint.hpp>
+
+#include "linearsvm.h"
+#include "log.h"
+
+#define MODEL_MAGIC "BLSV"
+#define MODEL_VERSION 1
+
+/* binary model file header, followed by size float weights */
+struct ModelHeader {
+	char magic[4];
+	boost::uint32_t version;
+	boost::int32_t winWidth, winHeight;
+	boost::int32_t blockWidth, blockHeight;
+	boost::int32_t strideWidth, strideHeight;
+	boost::int32_t cellWidth, cellHeight;
+	boost::int32_t nbins;
+	boost::uint32_t size;
+	float bias;
+	boost::uint32_t checksum; /* FNV-1a of weights and bias */
+};
+
+static boost::uint32_t checksum(const float* weights, unsigned int size,
+		float bias) {
+	boost::uint32_t h = 2166136261u;
+	const unsigned char *p = (const unsigned char*) weights;
+	for (size_t i = 0; i < size * sizeof(float); i++)
+		h = (h ^ p[i]) * 16777619u;
+	p = (const unsigned char*) &bias;
+	for (size_t i = 0; i < sizeof(float); i++)
+		h = (h ^ p[i]) * 16777619u;
+	return h;
+}
+
+/**
+ * Compute the diagonal of the dual Hessian: x.x + 1 (bias) + 1/(2C)
+ */
+class DiagonalInvoker: public cv::ParallelLoopBody {
+public:
+	DiagonalInvoker(const cv::Mat& _data, double _diag,
+			std::vector<double>& _QD) :
+			data(_data), diag(_diag), QD(_QD) {
+	}
+
+	virtual void operator()(const cv::Range& range) const {
+		for (int i = range.start; i < range.end; i++) {
+			QD[i] = data.row(i).dot(data.row(i)) + 1.0 + diag;
+		}
+	}
+
+private:
+	const cv::Mat& data;
+	double diag;
+	std::vector<double>& QD;
+};
+
+namespace linearsvm {
+
+void LinearSVM::getSupportVector(std::vector<float>& support_vector) const {
+
+	int sv_count = get_support_vector_count();
+	const CvSVMDecisionFunc* df = decision_func;
+	const double* alphas = df[0].alpha;
+	double rho = df[0].rho;
+	int var_count = get_var_count();
+	support_vector.resize(var_count, 0);
+	for (unsigned int r = 0; r < (unsigned) sv_count; r++) {
+		float myalpha = alphas[r];
+		const float* v = get_support_vector(r);
+		for (int j = 0; j < var_count; j++, v++) {
+			support_vector[j] += (-myalpha) * (*v);
+		}
+	}
+	support_vector.push_back(rho);
+}
+
+LinearModel::LinearModel() :
+		bias(0), weights(NULL), size(0), mapAddr(NULL), mapLen(0), winSize(
+				128, 64), blockSize(16, 16), blockStride(8, 8), cellSize(8,
+				8), nbins(9) {
+}
+
+LinearModel::LinearModel(const LinearModel& other) :
+		bias(other.bias), weights(NULL), size(0), mapAddr(NULL), mapLen(0), winSize(
+				other.winSize), blockSize(other.blockSize), blockStride(
+				other.blockStride), cellSize(other.cellSize), nbins(
+				other.nbins) {
+	setWeights(other.weights, other.size);
+}
+
+LinearModel& LinearModel::operator=(const LinearModel& other) {
+	if (this != &other) {
+		clear();
+		bias = other.bias;
+		winSize = other.winSize;
+		blockSize = other.blockSize;
+		blockStride = other.blockStride;
+		cellSize = other.cellSize;
+		nbins = other.nbins;
+		setWeights(other.weights, other.size);
+	}
+	return *this;
+}
+
+LinearModel::~LinearModel(void) {
+	clear();
+}
+
+void LinearModel::clear(void) {
+	if (mapAddr)
+		munmap(mapAddr, mapLen);
+	mapAddr = NULL;
+	mapLen = 0;
+	ownedWeights.clear();
+	weights = NULL;
+	size = 0;
+	bias = 0;
+}
+
+void LinearModel::setWeights(const float* w, unsigned int n) {
+	ownedWeights.assign(w, w + n);
+	weights = n ? &ownedWeights[0] : NULL;
+	size = n;
+}
+
+void LinearModel::setHOG(const cv::HOGDescriptor& hog) {
+	winSize = hog.winSize;
+	blockSize = hog.blockSize;
+	blockStride = hog.blockStride;
+	cellSize = hog.cellSize;
+	nbins = hog.nbins;
+}
+
+cv::HOGDescriptor LinearModel::getHOG(void) const {
+	return cv::HOGDescriptor(winSize, blockSize, blockStride, cellSize, nbins);
+}
+
+bool LinearModel::matches(const cv::HOGDescriptor& hog) const {
+	return (winSize == hog.winSize) && (blockSize == hog.blockSize)
+			&& (blockStride == hog.blockStride) && (cellSize == hog.cellSize)
+			&& (nbins == hog.nbins) && (size == hog.getDescriptorSize());
+}
+
+/*
+ * Dual coordinate descent for the L2-loss linear SVM, see Hsieh et al.,
+ * "A Dual Coordinate Descent Method for Large-scale Linear SVM", ICML 2008.
+ * Coordinate updates are inherently sequential, only the setup is parallel.
+ */
+int LinearModel::train(const cv::Mat& data, const cv::Mat& labels,
+		const struct SolverParams& params) {
+	std::vector<int> rows(data.rows);
+	for (int i = 0; i < data.rows; i++)
+		rows[i] = i;
+	return train(data, labels, params, rows);
+}
+
+int LinearModel::train(const cv::Mat& data, const cv::Mat& labels,
+		const struct SolverParams& params, const std::vector<int>& rows) {
+	int n = rows.size();
+	int d = data.cols;
+
+	if ((n == 0) || (data.type() != CV_32FC1) || (labels.rows != data.rows)
+			|| (labels.type() != CV_32FC1)) {
+		std::cerr << "ERROR: Invalid training data" << std::endl;
+		return -1;
+	}
+
+	double diag = 0.5 / params.C;
+	std::vector<double> QD(data.rows);
+	std::vector<double> alpha(data.rows, 0);
+	std::vector<double> w(d, 0);
+	double b = 0;
+	std::vector<int> index(rows);
+	cv::RNG rng;
+
+	cv::parallel_for_(cv::Range(0, data.rows), DiagonalInvoker(data, diag, QD));
+
+	int iter;
+	for (iter = 0; iter < params.maxIter; iter++) {
+		double PGmax = -DBL_MAX;
+		double PGmin = DBL_MAX;
+
+		/* visit coordinates in random order */
+		for (int i = 0; i < n - 1; i++)
+			std::swap(index[i], index[i + rng.uniform(0, n - i)]);
+
+		for (int s = 0; s < n; s++) {
+			int i = index[s];
+			const float *x = data.ptr<float>(i);
+			double yi = (labels.at<float>(i, 0) > 0) ? 1.0 : -1.0;
+
+			double G = b;
+			for (int k = 0; k < d; k++)
+				G += w[k] * x[k];
+			G = G * yi - 1.0 + alpha[i] * diag;
+
+			/* projected gradient */
+			double PG = G;
+			if ((alpha[i] == 0) && (G > 0))
+				PG = 0;
+			PGmax = std::max(PGmax, PG);
+			PGmin = std::min(PGmin, PG);
+
+			if (std::fabs(PG) > 1e-12) {
+				double alphaOld = alpha[i];
+				alpha[i] = std::max(alpha[i] - G / QD[i], 0.0);
+				double delta = (alpha[i] - alphaOld) * yi;
+				for (int k = 0; k < d; k++)
+					w[k] += delta * x[k];
+				b += delta;
+			}
+		}
+
+		LOGL(LOG_TRAIN,
+				"DCD iteration " << iter << " PG range=" << PGmax - PGmin);
+		if (PGmax - PGmin <= params.eps)
+			break;
+	}
+	LOGL(LOG_TRAIN, "DCD stopped after " << iter << " iterations");
+
+	std::vector<float> wf(w.begin(), w.end());
+	setWeights(&wf[0], d);
+	bias = b;
+	return 0;
+}
+
+void LinearModel::fromSVM(const LinearSVM& svm) {
+	std::vector<float> support_vector;
+	svm.getSupportVector(support_vector);
+	bias = support_vector.back();
+	support_vector.pop_back();
+	setWeights(&support_vector[0], support_vector.size());
+}
+
+float LinearModel::predict(const float* x) const {
+	double score = bias;
+	for (unsigned int k = 0; k < size; k++)
+		score += weights[k] * x[k];
+	return score;
+}
+
+float LinearModel::predict(const cv::Mat& row) const {
+	CV_Assert(
+			(row.type() == CV_32FC1) && (row.total() == size) && row.isContinuous());
+	return predict(row.ptr<float>(0));
+}
+
+void LinearModel::predict(const cv::Mat& data,
+		std::vector<float>& scores) const {
+	CV_Assert((data.type() == CV_32FC1) && ((unsigned) data.cols == size));
+	scores.resize(data.rows);
+	if (data.rows == 0)
+		return;
+	cv::Mat w(size, 1, CV_32FC1, (void*) weights);
+	cv::Mat s(data.rows, 1, CV_32FC1, &scores[0]);
+	cv::gemm(data, w, 1.0, cv::Mat(), 0.0, s);
+	s += bias;
+}
+
+std::vector<float> LinearModel::detector(void) const {
+	std::vector<float> det(weights, weights + size);
+	det.push_back(bias);
+	return det;
+}
+
+int LinearModel::save(std::string filename) const {
+	cv::FileStorage storage(filename, cv::FileStorage::WRITE);
+	if (!storage.isOpened()) {
+		std::cerr << "ERROR: Could not write " << filename << std::endl;
+		return -1;
+	}
+	int hogParams[] = { winSize.width, winSize.height, blockSize.width,
+			blockSize.height, blockStride.width, blockStride.height,
+			cellSize.width, cellSize.height, nbins };
+
+	storage << "linear_svm" << "{";
+	storage << "hog" << std::vector<int>(hogParams, hogParams + 9);
+	storage << "bias" << bias;
+	storage << "weights" << cv::Mat(1, size, CV_32FC1, (void*) weights);
+	storage << "}";
+	return 0;
+}
+
+int LinearModel::saveBinary(std::string filename) const {
+	struct ModelHeader header;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MODEL_MAGIC, sizeof(header.magic));
+	header.version = MODEL_VERSION;
+	header.winWidth = winSize.width;
+	header.winHeight = winSize.height;
+	header.blockWidth = blockSize.width;
+	header.blockHeight = blockSize.height;
+	header.strideWidth = blockStride.width;
+	header.strideHeight = blockStride.height;
+	header.cellWidth = cellSize.width;
+	header.cellHeight = cellSize.height;
+	header.nbins = nbins;
+	header.size = size;
+	header.bias = bias;
+	header.checksum = checksum(weights, size, bias);
+
+	FILE *f = fopen(filename.c_str(), "wb");
+	if ((!f) || (fwrite(&header, sizeof(header), 1, f) != 1)
+			|| (fwrite(weights, sizeof(float), size, f) != size)) {
+		std::cerr << "ERROR: Could not write " << filename << std::endl;
+		if (f)
+			fclose(f);
+		return -1;
+	}
+	fclose(f);
+	return 0;
+}
+
+int LinearModel::loadBinary(std::string filename) {
+	struct ModelHeader header;
+	struct stat st;
+
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		std::cerr << "ERROR: Could not read " << filename << std::endl;
+		return -1;
+	}
+	if ((fstat(fd, &st) < 0) || ((size_t) st.st_size < sizeof(header))) {
+		::close(fd);
+		return -1;
+	}
+	mapLen = st.st_size;
+	mapAddr = mmap(NULL, mapLen, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (mapAddr == MAP_FAILED) {
+		std::cerr << "ERROR: Could not map " << filename << std::endl;
+		mapAddr = NULL;
+		mapLen = 0;
+		return -1;
+	}
+
+	memcpy(&header, mapAddr, sizeof(header));
+	const float *w = (const float*) ((const char*) mapAddr + sizeof(header));
+	if ((header.version != MODEL_VERSION)
+			|| (mapLen != sizeof(header) + header.size * sizeof(float))
+			|| (header.checksum != checksum(w, header.size, header.bias))) {
+		std::cerr << "ERROR: Corrupted model file " << filename << std::endl;
+		clear();
+		return -1;
+	}
+
+	weights = w;
+	size = header.size;
+	bias = header.bias;
+	winSize = cv::Size(header.winWidth, header.winHeight);
+	blockSize = cv::Size(header.blockWidth, header.blockHeight);
+	blockStride = cv::Size(header.strideWidth, header.strideHeight);
+	cellSize = cv::Size(header.cellWidth, header.cellHeight);
+	nbins = header.nbins;
+	return 0;
+}
+
+int LinearModel::load(std::string filename) {
+	char magic[sizeof(MODEL_MAGIC) - 1];
+
+	clear();
+
+	/* binary format */
+	FILE *f = fopen(filename.c_str(), "rb");
+	if (!f) {
+		std::cerr << "ERROR: Could not read " << filename << std::endl;
+		return -1;
+	}
+	size_t n = fread(magic, 1, sizeof(magic), f);
+	fclose(f);
+	if ((n == sizeof(magic)) && (!memcmp(magic, MODEL_MAGIC, sizeof(magic))))
+		return loadBinary(filename);
+
+	/* linear model in OpenCV XML/YAML */
+	cv::FileStorage storage(filename, cv::FileStorage::READ);
+	if (!storage.isOpened()) {
+		std::cerr << "ERROR: Could not read " << filename << std::endl;
+		return -1;
+	}
+
+	cv::FileNode node = storage["linear_svm"];
+	if (!node.empty()) {
+		cv::Mat w;
+		std::vector<int> hogParams;
+		node["weights"] >> w;
+		node["hog"] >> hogParams;
+		if (hogParams.size() == 9) {
+			winSize = cv::Size(hogParams[0], hogParams[1]);
+			blockSize = cv::Size(hogParams[2], hogParams[3]);
+			blockStride = cv::Size(hogParams[4], hogParams[5]);
+			cellSize = cv::Size(hogParams[6], hogParams[7]);
+			nbins = hogParams[8];
+		}
+		setWeights(w.ptr<float>(0), w.total());
+		bias = (float) node["bias"];
+		return 0;
+	}
+	storage.release();
+
+	/* not a linear model, try a CvSVM model with linear kernel */
+	LinearSVM svm;
+	try {
+		svm.load(filename.c_str());
+	} catch (cv::Exception&) {
+		std::cerr << "ERROR: Could not load SVM model " << filename
+				<< std::endl;
+		return -1;
+	}
+	if (svm.get_var_count() == 0)
+		return -1;
+	fromSVM(svm);
+	return 0;
+}
+
+int convert(std::string inFile, std::string outFile) {
+	LinearModel model;
+
+	if (model.load(inFile) < 0)
+		return -1;
+	if (model.saveBinary(outFile) < 0)
+		return -1;
+	std::cout << "Converted " << inFile << " (" << model.getSize()
+			<< " weights) to " << outFile << std::endl;
+	return 0;
+}
+
+} /* namespace linearsvm */
@@ -0,0 +1,84 @@
+#ifndef LINEARSVM_H
+#define LINEARSVM_H
+
+#include <string>
+#include <vector>
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/objdetect/objdetect.hpp"
+#include "opencv2/ml/ml.hpp"
+
+namespace linearsvm
+{
+	/* CvSVM with linear kernel, exposing the equivalent weight vector */
+	class LinearSVM: public CvSVM {
+	public:
+		/* weights followed by bias, as expected by HOGDescriptor::setSVMDetector */
+		void getSupportVector(std::vector<float>& support_vector) const;
+	};
+
+	struct SolverParams {
+		double C; /* penalty parameter */
+		int maxIter; /* maximum number of passes over the data */
+		double eps; /* stopping tolerance on projected gradient */
+	};
+
+	/**
+	 * Linear model: score(x) = weights.x + bias, positive for bibs.
+	 * Weights are either owned or mapped read-only from a binary model
+	 * file, so that worker processes share the same pages.
+	 */
+	class LinearModel {
+	public:
+		LinearModel(void);
+		LinearModel(const LinearModel& other);
+		LinearModel& operator=(const LinearModel& other);
+		~LinearModel(void);
+		/* train with dual coordinate descent (L2-loss SVM), labels are +1/-1 */
+		int train(const cv::Mat& data, const cv::Mat& labels,
+				const struct SolverParams& params);
+		/* as above, using only the given rows of data and labels */
+		int train(const cv::Mat& data, const cv::Mat& labels,
+				const struct SolverParams& params, const std::vector<int>& rows);
+		/* convert a trained CvSVM */
+		void fromSVM(const LinearSVM& svm);
+		float predict(const float* x) const;
+		float predict(const cv::Mat& row) const;
+		/* score every row of data (CV_32F) with one matrix-vector product */
+		void predict(const cv::Mat& data, std::vector<float>& scores) const;
+		/* weights followed by bias */
+		std::vector<float> detector(void) const;
+		/* HOG geometry the model applies to */
+		void setHOG(const cv::HOGDescriptor& hog);
+		bool matches(const cv::HOGDescriptor& hog) const;
+		cv::HOGDescriptor getHOG(void) const;
+		/* save as OpenCV XML/YAML */
+		int save(std::string filename) const;
+		/* save in compact binary format */
+		int saveBinary(std::string filename) const;
+		/* load binary (mapped), XML/YAML or CvSVM model */
+		int load(std::string filename);
+		bool empty(void) const { return size == 0; }
+		const float* getWeights(void) const { return weights; }
+		unsigned int getSize(void) const { return size; }
+
+		float bias;
+	private:
+		void clear(void);
+		void setWeights(const float* w, unsigned int n);
+		int loadBinary(std::string filename);
+
+		const float* weights; /* points to ownedWeights or into mapping */
+		unsigned int size;
+		std::vector<float> ownedWeights;
+		void* mapAddr;
+		size_t mapLen;
+		cv::Size winSize, blockSize, blockStride, cellSize;
+		int nbins;
+	};
+
+	/* convert any model file loadable by LinearModel to binary format */
+	int convert(std::string inFile, std::string outFile);
+}
+
+#endif /* #ifndef LINEARSVM_H */
@@ -7,6 +7,8 @@
 #include "pipeline.h"
 #include "facedetection.h"
 #include "textdetection.h"
+#include "bibdetection.h"
+#include "log.h"
 
 #include "stdio.h"
 
@@ -21,10 +23,93 @@ static void vectorAtoi(std::vector<int>&numbers, std::vector<std::string>&text)
 	}
 }
 
+/**
+ * Append the numbers read in a bib detection that were not already read,
+ * e.g. in the full frame
+ */
+static void appendNew(std::vector<std::string>& text,
+		std::vector<struct textrecognition::OcrConfidence>& confidences,
+		const std::vector<std::string>& newText,
+		const std::vector<struct textrecognition::OcrConfidence>& newConfidences) {
+	for (unsigned int i = 0; i < newText.size(); i++) {
+		std::string number = boost::algorithm::trim_copy(newText[i]);
+		bool found = false;
+		for (unsigned int j = 0; (j < text.size()) && !found; j++)
+			found = (boost::algorithm::trim_copy(text[j]) == number);
+		if (found)
+			continue;
+		text.push_back(newText[i]);
+		confidences.push_back(newConfidences[i]);
+	}
+}
+
+/* margin around HOG+SVM bib detections, in percent of detection size */
+#define BIB_DETECTION_MARGIN 25
+
+Pipeline::Pipeline(const struct PipelineParams &_params) :
+		params(_params) {
+	textDetector.setDebugImages(params.debugImages);
+	textRecognizer.setDebugImages(params.debugImages);
+	textRecognizer.setOcrMode(params.ocrMode);
+	textRecognizer.setCropOutput(params.crops);
+	textRecognizer.setOcrBudget(params.maxOcrChains);
+	textRecognizer.setSkipChecks(params.skipChecksConfidence,
+			params.skipChecksMinLength);
+	if ((params.detectionMode != DETECTION_SWT) && (!params.svmModel.empty())) {
+		if (model.load(params.svmModel) < 0)
+			std::cerr << "ERROR: Could not load SVM model, HOG+SVM bib detection disabled"
+					<< std::endl;
+	}
+	if (!params.digitModel.empty()) {
+		if (textRecognizer.loadDigitModel(params.digitModel) < 0)
+			std::cerr << "ERROR: Could not load digit classifier, using Tesseract"
+					<< std::endl;
+	}
+}
+
+int Pipeline::processRegion(cv::Mat& img, struct TextDetectionParams &textParams,
+		std::vector<std::string>& text,
+		std::vector<struct textrecognition::OcrConfidence>& confidences) {
+	IplImage ipl_img = img;
+	std::vector<Chain> chains;
+	std::vector<std::pair<Point2d, Point2d> > compBB;
+	std::vector<std::pair<CvPoint, CvPoint> > chainBB;
+
+	/* bib detections are views of the full image */
+	cv::Size wholeSize;
+	cv::Point offset;
+	img.locateROI(wholeSize, offset);
+	textRecognizer.setSource(imageName, offset);
+
+	textDetector.detect(&ipl_img, textParams, chains, compBB, chainBB);
+	return textRecognizer.recognize(&ipl_img, textParams, params.svmModel,
+			chains, compBB, chainBB, text, confidences);
+}
+
+bool Pipeline::prescreen(const cv::Mat& thumbnail) const {
+	if ((params.prescreenDensity <= 0) || thumbnail.empty())
+		return true;
+
+	cv::Mat gray, edges;
+	if (thumbnail.channels() == 3)
+		cv::cvtColor(thumbnail, gray, CV_BGR2GRAY);
+	else
+		gray = thumbnail;
+	cv::Canny(gray, edges, params.cannyLow, params.cannyHigh, 3);
+
+	/* same borders as text detection */
+	int top = edges.rows * 10 / 100;
+	int bottom = edges.rows * 5 / 100;
+	cv::Mat roi = edges.rowRange(top, edges.rows - bottom);
+	double density = (double) cv::countNonZero(roi) / roi.total();
+	LOGL(LOG_TEXTREC, "Thumbnail edge density " << density);
+	return density >= params.prescreenDensity;
+}
+
 int Pipeline::processImage(
 		cv::Mat& img,
-		std::string svmModel,
-		std::vector<int>& bibNumbers) {
+		std::vector<int>& bibNumbers,
+		std::vector<struct textrecognition::OcrConfidence>& confidences) {
 #if 0
 	int res;
 	const double scale = 1;
@@ -101,9 +186,8 @@ int Pipeline::processImage(
 		}
 	}
 #else
-	IplImage ipl_img = img;
 	std::vector<std::string> text;
-	struct TextDetectionParams params = {
+	struct TextDetectionParams textParams = {
 						1, /* darkOnLight */
 						15, /* maxStrokeLength */
 						11, /* minCharacterHeight */
@@ -114,27 +198,78 @@ int Pipeline::processImage(
 						3, /* min chain len */
 						0, /* verify with SVM model up to this chain len */
 						0, /* height needs to be this large to verify with model */
+						params.cannyLow, /* Canny low threshold */
+						params.cannyHigh, /* Canny high threshold */
+						params.maxColorDist, /* colour distance of paired components */
+						&deadline, /* per-image time budget */
 				};
 
-	if (!svmModel.empty())
+	deadline.start(params.imageBudget);
+
+	if (!params.svmModel.empty())
 	{
 		/* lower min chain len */
-		params.minChainLen = 2;
+		textParams.minChainLen = 2;
 		/* verify with SVM model up to this chain len */
-		params.modelVerifLenCrit = 2;
+		textParams.modelVerifLenCrit = 2;
 		/* height needs to be this large to verify with model */
-		params.modelVerifMinHeight = 15;
+		textParams.modelVerifMinHeight = 15;
 	}
 
-	std::vector<Chain> chains;
-	std::vector<std::pair<Point2d, Point2d> > compBB;
-	std::vector<std::pair<CvPoint, CvPoint> > chainBB;
-	textDetector.detect(&ipl_img, params, chains, compBB, chainBB);
-	textRecognizer.recognize(&ipl_img, params, svmModel, chains, compBB, chainBB, text);
+	if ((params.detectionMode != DETECTION_HOG) || model.empty()) {
+		/* full frame */
+		processRegion(img, textParams, text, confidences);
+	}
+
+	if ((params.detectionMode != DETECTION_SWT) && !model.empty()) {
+		/* regions proposed by the HOG+SVM bib detector */
+		const struct bibdetection::BibDetectionParams bibParams = {
+				1.2, /* scaleStep */
+				0, /* hitThreshold */
+				0.3, /* nmsOverlap */
+				64, /* minBibWidth */
+				&deadline, /* per-image time budget */
+		};
+		std::vector<cv::Rect> bibs;
+		std::vector<double> scores;
+		if (deadline.expired())
+			LOGL(LOG_TEXTREC, "Time budget exceeded, skipping bib detection");
+		else
+			bibdetection::processImage(img, model, bibParams, bibs, scores);
+
+		for (unsigned int i = 0; i < bibs.size(); i++) {
+			if (deadline.expired()) {
+				LOGL(LOG_TEXTREC,
+						"Time budget exceeded, skipping " << bibs.size() - i << " bib detections");
+				break;
+			}
+			int dx = bibs[i].width * BIB_DETECTION_MARGIN / 100;
+			int dy = bibs[i].height * BIB_DETECTION_MARGIN / 100;
+			cv::Rect roi = cv::Rect(bibs[i].x - dx, bibs[i].y - dy,
+					bibs[i].width + 2 * dx, bibs[i].height + 2 * dy)
+					& cv::Rect(0, 0, img.cols, img.rows);
+			cv::Mat subImage = img(roi);
+			struct TextDetectionParams roiParams = textParams;
+			/* borders of the full frame, in detection coordinates */
+			roiParams.topBorder = std::max(0, textParams.topBorder - roi.y);
+			roiParams.bottomBorder = std::max(0,
+					roi.y + roi.height - (img.rows - textParams.bottomBorder));
+			LOGL(LOG_TEXTREC, "Processing bib detection " << roi);
+			std::vector<std::string> roiText;
+			std::vector<struct textrecognition::OcrConfidence> roiConfidences;
+			processRegion(subImage, roiParams, roiText, roiConfidences);
+			appendNew(text, confidences, roiText, roiConfidences);
+		}
+	}
 	vectorAtoi(bibNumbers, text);
 #endif
-	cv::imwrite("face-detection.png", img);
+	if (params.debugImages)
+		cv::imwrite("face-detection.png", img);
 
+	if (deadline.isDegraded()) {
+		LOGL(LOG_TEXTREC, "Time budget exceeded, results are partial");
+		return 1;
+	}
 	return 0;
 
 }
@@ -4,13 +4,76 @@
 #include "opencv2/imgproc/imgproc.hpp"
 #include "textdetection.h"
 #include "textrecognition.h"
+#include "linearsvm.h"
+#include "deadline.h"
+#include "cropwriter.h"
 
 namespace pipeline
 {
+	enum DetectionMode {
+		DETECTION_SWT, /* stroke width transform over the full frame */
+		DETECTION_HOG, /* stroke width transform in HOG+SVM bib detections only */
+		DETECTION_SWT_HOG /* both */
+	};
+
+	struct PipelineParams {
+		PipelineParams() :
+				detectionMode(DETECTION_SWT), ocrMode(textrecognition::OCR_CHAIN),
+				skipChecksConfidence(0), skipChecksMinLength(0), maxOcrChains(0),
+				imageBudget(0), retryDegraded(false), prefetchBytes(64 << 20),
+				prescreenDensity(0), debugImages(true), cannyLow(175),
+				cannyHigh(320), maxColorDist(0) {
+		}
+		std::string svmModel; /* SVM model file, empty if none */
+		std::string digitModel; /* digit classifier model file, empty for Tesseract */
+		enum DetectionMode detectionMode;
+		enum textrecognition::OcrMode ocrMode;
+		float skipChecksConfidence; /* 0 to always run SVM and symmetry checks */
+		unsigned int skipChecksMinLength;
+		unsigned int maxOcrChains; /* OCR budget per image, 0 for none */
+		double imageBudget; /* processing time budget per image in ms, 0 for none */
+		bool retryDegraded; /* batch: process degraded images again without budget */
+		size_t prefetchBytes; /* batch: image files read ahead, 0 for none */
+		double prescreenDensity; /* minimum edge density of EXIF thumbnails, 0 for none */
+		bool debugImages; /* save the intermediate images of detection and recognition */
+		float cannyLow; /* edge thresholds of text detection and prescreen */
+		float cannyHigh;
+		float maxColorDist; /* of paired components (RGB), 0 for none */
+		struct cropwriter::CropWriterParams crops; /* bib and digit crops */
+	};
+
 	class Pipeline {
 	public:
-		int processImage(cv::Mat& img, std::string svmModel, std::vector<int>& bibNumbers);
+		Pipeline(const struct PipelineParams &params);
+		/**
+		 * confidences holds the OCR confidence of each bib number
+		 * @return 0, 1 if the time budget was exceeded and the results are
+		 * degraded, -1 on error
+		 */
+		int processImage(cv::Mat& img, std::vector<int>& bibNumbers,
+				std::vector<struct textrecognition::OcrConfidence>& confidences);
+		/**
+		 * Cheap check of a downscaled image (e.g. the EXIF thumbnail) for
+		 * text before processing the full image
+		 * @return false if the image has no text to read
+		 */
+		bool prescreen(const cv::Mat& thumbnail) const;
+		bool hasPrescreen(void) const { return params.prescreenDensity > 0; }
+		void setImageBudget(double ms) { params.imageBudget = ms; }
+		/* file name of the next image, saved with its crops */
+		void setImageName(const std::string& name) { imageName = name; }
+		const struct textrecognition::OcrStats& getOcrStats(void) const {
+			return textRecognizer.getOcrStats();
+		}
 	private:
+		int processRegion(cv::Mat& img, struct TextDetectionParams &params,
+				std::vector<std::string>& text,
+				std::vector<struct textrecognition::OcrConfidence>& confidences);
+
+		struct PipelineParams params;
+		std::string imageName;
+		linearsvm::LinearModel model; /* for HOG+SVM bib detection */
+		deadline::Deadline deadline; /* of the image being processed */
 		textdetection::TextDetector textDetector;
 		textrecognition::TextRecognizer textRecognizer;
 	};
@@ -18,4 +81,3 @@ namespace pipeline
 }
 
 #endif /* #ifndef PIPELINE_H */
-
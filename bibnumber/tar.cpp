@@ -0,0 +1,352 @@
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+
+#include "tar.h"
+
+namespace fs = boost::filesystem;
+
+/* archives are made of 512-byte blocks and end with two zero blocks */
+#define TAR_BLOCK 512
+#define TAR_END_BLOCKS 2
+
+/* ustar header fields: offset and length */
+#define TAR_NAME 0, 100
+#define TAR_MODE 100, 8
+#define TAR_UID 108, 8
+#define TAR_GID 116, 8
+#define TAR_SIZE 124, 12
+#define TAR_MTIME 136, 12
+#define TAR_CHKSUM 148, 8
+#define TAR_TYPE 156
+#define TAR_MAGIC 257, 6
+#define TAR_VERSION 263, 2
+#define TAR_PREFIX 345, 155
+
+static off_t padding(off_t size) {
+	return (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+}
+
+/* string field, NUL terminated unless it fills the field */
+static std::string field(const unsigned char *header, int offset, int len) {
+	const char *s = (const char *) header + offset;
+	return std::string(s, std::find(s, s + len, '\0'));
+}
+
+/* octal number field, or base-256 if the high bit of the first byte is set */
+static off_t number(const unsigned char *header, int offset, int len) {
+	const unsigned char *p = header + offset;
+	off_t value = 0;
+	if (p[0] & 0x80) {
+		value = p[0] & 0x7f;
+		for (int i = 1; i < len; i++)
+			value = (value << 8) | p[i];
+		return value;
+	}
+	int i = 0;
+	while ((i < len) && ((p[i] == ' ') || (p[i] == '\0')))
+		i++;
+	for (; (i < len) && (p[i] >= '0') && (p[i] <= '7'); i++)
+		value = value * 8 + (p[i] - '0');
+	return value;
+}
+
+static void setNumber(unsigned char *header, int offset, int len,
+		unsigned long value) {
+	/* len - 1 octal digits followed by NUL */
+	snprintf((char *) header + offset, len, "%0*lo", len - 1, value);
+}
+
+static void setString(unsigned char *header, int offset, int len,
+		const std::string& s) {
+	memcpy(header + offset, s.data(), std::min((size_t) len, s.size()));
+}
+
+/* sum of the header bytes, the checksum field counted as spaces */
+static unsigned int checksum(const unsigned char *header) {
+	unsigned int sum = 0;
+	for (int i = 0; i < TAR_BLOCK; i++)
+		sum += ((i >= 148) && (i < 156)) ? ' ' : header[i];
+	return sum;
+}
+
+/* parse "<length> <key>=<value>\n" records of a pax extended header */
+static void parsePax(const std::vector<unsigned char>& data,
+		std::string& path, std::string& comment) {
+	std::string records(data.begin(), data.end());
+	size_t pos = 0;
+	while (pos < records.size()) {
+		size_t space = records.find(' ', pos);
+		if (space == std::string::npos)
+			break;
+		size_t len = atol(records.substr(pos, space - pos).c_str());
+		if ((len == 0) || (pos + len > records.size()))
+			break;
+		std::string record = records.substr(space + 1, pos + len - space - 2);
+		size_t eq = record.find('=');
+		if (eq != std::string::npos) {
+			std::string key = record.substr(0, eq);
+			if (key == "path")
+				path = record.substr(eq + 1);
+			else if (key == "comment")
+				comment = record.substr(eq + 1);
+		}
+		pos += len;
+	}
+}
+
+/* pax record "<length> <key>=<value>\n", the length counting itself */
+static std::string paxRecord(const std::string& key, const std::string& value) {
+	std::string record = " " + key + "=" + value + "\n";
+	size_t len = record.size() + 1;
+	for (;;) {
+		std::ostringstream s;
+		s << len;
+		if (len == record.size() + s.str().size())
+			return s.str() + record;
+		len = record.size() + s.str().size();
+	}
+}
+
+namespace tar {
+
+TarReader::TarReader(void) :
+		file(NULL), end(0) {
+}
+
+TarReader::~TarReader(void) {
+	close();
+}
+
+int TarReader::open(std::string _path) {
+	close();
+	path = _path;
+	end = 0;
+	file = fopen(path.c_str(), "rb");
+	if (!file) {
+		std::cerr << "ERROR: Could not open " << path << std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+void TarReader::close(void) {
+	if (file)
+		fclose(file);
+	file = NULL;
+}
+
+int TarReader::skip(off_t size) {
+	if (fseeko(file, size + padding(size), SEEK_CUR) != 0) {
+		std::cerr << "ERROR: Truncated archive " << path << std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+int TarReader::readBlocks(off_t size, std::vector<unsigned char>& data) {
+	data.resize(size);
+	if ((size > 0) && (fread(&data[0], 1, size, file) != (size_t) size)) {
+		std::cerr << "ERROR: Truncated archive " << path << std::endl;
+		return -1;
+	}
+	if (fseeko(file, padding(size), SEEK_CUR) != 0) {
+		std::cerr << "ERROR: Truncated archive " << path << std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+int TarReader::next(struct Entry& entry, bool readData,
+		bool (*wanted)(std::string name)) {
+	std::string longName, paxPath, paxComment;
+	std::vector<unsigned char> data;
+	unsigned char header[TAR_BLOCK];
+
+	if (!file)
+		return -1;
+	for (;;) {
+		size_t n = fread(header, 1, TAR_BLOCK, file);
+		if (n == 0)
+			return 0; /* no end-of-archive marker */
+		if (n < TAR_BLOCK) {
+			std::cerr << "ERROR: Truncated archive " << path << std::endl;
+			return -1;
+		}
+		if (std::count(header, header + TAR_BLOCK, 0) == TAR_BLOCK)
+			return 0;
+		if (number(header, TAR_CHKSUM) != (off_t) checksum(header)) {
+			std::cerr << "ERROR: Bad header checksum in " << path << std::endl;
+			return -1;
+		}
+
+		off_t size = number(header, TAR_SIZE);
+		char type = header[TAR_TYPE];
+		if ((type == 'L') || (type == 'x')) {
+			/* GNU long name or pax extended header of the next entry */
+			if (readBlocks(size, data) < 0)
+				return -1;
+			if (type == 'L')
+				longName.assign(data.begin(),
+						std::find(data.begin(), data.end(), '\0'));
+			else
+				parsePax(data, paxPath, paxComment);
+			end = ftello(file);
+			continue;
+		}
+		if (!paxPath.empty())
+			entry.name = paxPath;
+		else if (!longName.empty())
+			entry.name = longName;
+		else {
+			entry.name = field(header, TAR_NAME);
+			std::string prefix = field(header, TAR_PREFIX);
+			if (boost::algorithm::starts_with(field(header, TAR_MAGIC),
+					"ustar") && !prefix.empty())
+				entry.name = prefix + "/" + entry.name;
+		}
+		if (((type != '0') && (type != '\0') && (type != '7'))
+				|| (wanted && !wanted(entry.name))) {
+			/* directories, links, global headers, unwanted files... */
+			if (skip(size) < 0)
+				return -1;
+			end = ftello(file);
+			longName.clear();
+			paxPath.clear();
+			paxComment.clear();
+			continue;
+		}
+		entry.comment = paxComment;
+		entry.mtime = number(header, TAR_MTIME);
+		entry.size = size;
+		if (readData) {
+			if (readBlocks(size, entry.data) < 0)
+				return -1;
+		} else {
+			entry.data.clear();
+			if (skip(size) < 0)
+				return -1;
+		}
+		end = ftello(file);
+		return 1;
+	}
+}
+
+TarWriter::TarWriter(void) :
+		file(NULL) {
+}
+
+TarWriter::~TarWriter(void) {
+	close();
+}
+
+int TarWriter::open(std::string _path) {
+	boost::system::error_code ec;
+
+	close();
+	path = _path;
+	if (fs::exists(path) && (fs::file_size(path, ec) > 0)) {
+		/* append after the last entry, over the end-of-archive marker */
+		TarReader reader;
+		struct Entry entry;
+		int res;
+		if (reader.open(path) < 0)
+			return -1;
+		while ((res = reader.next(entry, false)) > 0)
+			;
+		if (res < 0)
+			return -1;
+		off_t end = reader.tell();
+		reader.close();
+		file = fopen(path.c_str(), "r+b");
+		if (file && (fseeko(file, end, SEEK_SET) != 0)) {
+			fclose(file);
+			file = NULL;
+		}
+	} else {
+		file = fopen(path.c_str(), "wb");
+	}
+	if (!file) {
+		std::cerr << "ERROR: Could not open " << path << " for writing"
+				<< std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+void TarWriter::close(void) {
+	if (file)
+		fclose(file);
+	file = NULL;
+}
+
+int TarWriter::writeEntry(const std::string& name, char type,
+		const unsigned char *data, size_t size) {
+	unsigned char header[TAR_BLOCK];
+	static const unsigned char zeros[TAR_BLOCK * TAR_END_BLOCKS] = { 0 };
+
+	if (name.size() > 100) {
+		std::cerr << "ERROR: Name too long for archive: " << name << std::endl;
+		return -1;
+	}
+	memset(header, 0, sizeof(header));
+	setString(header, TAR_NAME, name);
+	setNumber(header, TAR_MODE, 0644);
+	setNumber(header, TAR_UID, 0);
+	setNumber(header, TAR_GID, 0);
+	setNumber(header, TAR_SIZE, size);
+	setNumber(header, TAR_MTIME, std::time(0));
+	header[TAR_TYPE] = type;
+	setString(header, TAR_MAGIC, std::string("ustar", 6));
+	setString(header, TAR_VERSION, "00");
+	/* six octal digits, NUL and space */
+	snprintf((char *) header + 148, 8, "%06o", checksum(header));
+	header[155] = ' ';
+
+	if ((fwrite(header, 1, TAR_BLOCK, file) != TAR_BLOCK)
+			|| (fwrite(data, 1, size, file) != size)
+			|| (fwrite(zeros, 1, padding(size), file)
+					!= (size_t) padding(size))) {
+		std::cerr << "ERROR: Could not write to " << path << std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+int TarWriter::append(const std::string& name, const unsigned char *data,
+		size_t size, const std::string& comment) {
+	static const unsigned char zeros[TAR_BLOCK * TAR_END_BLOCKS] = { 0 };
+
+	if (!file)
+		return -1;
+	if (!comment.empty()) {
+		std::string record = paxRecord("comment", comment);
+		if (writeEntry("PaxHeaders/" + name.substr(0, 89), 'x',
+				(const unsigned char *) record.data(), record.size()) < 0)
+			return -1;
+	}
+	if (writeEntry(name, '0', data, size) < 0)
+		return -1;
+	/* end-of-archive marker, overwritten by the next entry */
+	if ((fwrite(zeros, 1, sizeof(zeros), file) != sizeof(zeros))
+			|| (fseeko(file, -(off_t) sizeof(zeros), SEEK_CUR) != 0)
+			|| (fflush(file) != 0)) {
+		std::cerr << "ERROR: Could not write to " << path << std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+bool isArchive(std::string path) {
+	std::string name(path);
+	std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+	return boost::algorithm::ends_with(name, ".tar") && fs::is_regular_file(path);
+}
+
+} /* namespace tar */
@@ -0,0 +1,81 @@
+#ifndef TAR_H
+#define TAR_H
+
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace tar
+{
+	/* a regular file of an archive */
+	struct Entry {
+		std::string name;
+		std::string comment; /* pax "comment" record, empty if none */
+		std::time_t mtime;
+		off_t size;
+		std::vector<unsigned char> data; /* empty unless read */
+	};
+
+	/**
+	 * Sequential reader of POSIX ustar archives, with GNU long names and
+	 * pax extended headers. Only regular files are returned.
+	 */
+	class TarReader {
+	public:
+		TarReader(void);
+		~TarReader(void);
+		int open(std::string path);
+		void close(void);
+		/**
+		 * Read the next regular file whose name is accepted by wanted (all
+		 * files if NULL), with its contents if readData
+		 * @return 1 if an entry was read, 0 at the end of the archive, -1 on
+		 * error
+		 */
+		int next(struct Entry& entry, bool readData = true,
+				bool (*wanted)(std::string name) = NULL);
+		/* offset of the end of the last entry read */
+		off_t tell(void) const { return end; }
+	private:
+		int skip(off_t size);
+		int readBlocks(off_t size, std::vector<unsigned char>& data);
+
+		FILE *file;
+		std::string path;
+		off_t end;
+	};
+
+	/**
+	 * Appends regular files to a ustar archive. The end-of-archive marker is
+	 * written after every entry, so that the archive stays readable if the
+	 * program is interrupted.
+	 */
+	class TarWriter {
+	public:
+		TarWriter(void);
+		~TarWriter(void);
+		/* open archive for appending, creating it if needed */
+		int open(std::string path);
+		void close(void);
+		bool isOpen(void) const { return file != NULL; }
+		/**
+		 * Append a file, preceded by a pax header holding comment if it is
+		 * not empty
+		 */
+		int append(const std::string& name, const unsigned char *data,
+				size_t size, const std::string& comment = "");
+	private:
+		int writeEntry(const std::string& name, char type,
+				const unsigned char *data, size_t size);
+
+		FILE *file;
+		std::string path;
+	};
+
+	bool isArchive(std::string path);
+}
+
+#endif /* #ifndef TAR_H */
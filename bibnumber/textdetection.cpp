@@ -46,6 +46,14 @@
 #define COM_MAX_DIST_RATIO (2.0)
 #define COM_MAX_ASPECT_RATIO (2.5)
 
+/* Scharr response to a step edge of the 5x5 gaussian smoothed [0,1] image
+ * (10) relative to the Sobel response of the 8-bit image used by cvCanny
+ * (4*255), so that Canny thresholds keep their usual scale */
+#define CANNY_GRADIENT_SCALE (10.0 / (4 * 255))
+
+#define CANNY_EDGE 255
+#define CANNY_WEAK 1
+
 static inline int square(int x) {
 	return x * x;
 }
@@ -55,14 +63,14 @@ static int inline ratio_within(float ratio, float max_ratio) {
 }
 
 std::vector<std::pair<CvPoint, CvPoint> > findBoundingBoxes(
-		std::vector<Chain> & chains,
-		std::vector<std::pair<Point2d, Point2d> > & compBB, IplImage * output) {
+		const std::vector<Chain> & chains,
+		const std::vector<std::pair<Point2d, Point2d> > & compBB, CvSize size) {
 	std::vector<std::pair<CvPoint, CvPoint> > bb;
 	bb.reserve(chains.size());
-	for (std::vector<Chain>::iterator chainit = chains.begin();
+	for (std::vector<Chain>::const_iterator chainit = chains.begin();
 			chainit != chains.end(); chainit++) {
-		int minx = output->width;
-		int miny = output->height;
+		int minx = size.width;
+		int miny = size.height;
 		int maxx = 0;
 		int maxy = 0;
 		for (std::vector<int>::const_iterator cit = chainit->components.begin();
@@ -237,8 +245,7 @@ void renderComponentsWithBoxes(IplImage * SWTImage,
 void renderChainsWithBoxes(IplImage * SWTImage,
 		std::vector<std::vector<Point2d> > & components,
 		std::vector<Chain> & chains,
-		std::vector<std::pair<Point2d, Point2d> > & compBB,
-		std::vector<std::pair<CvPoint, CvPoint> > & bb,
+		const std::vector<std::pair<CvPoint, CvPoint> > & bb,
 		IplImage * output) {
 	// keep track of included components
 	std::vector<bool> included;
@@ -265,13 +272,16 @@ void renderChainsWithBoxes(IplImage * SWTImage,
 
 	renderComponents(SWTImage, componentsRed, outTemp);
 
-	bb = findBoundingBoxes(chains, compBB, outTemp);
-
 	IplImage * out = cvCreateImage(cvGetSize(output), IPL_DEPTH_8U, 1);
 	cvConvertScale(outTemp, out, 255, 0);
 	cvCvtColor(out, output, CV_GRAY2RGB);
 	cvReleaseImage(&out);
 	cvReleaseImage(&outTemp);
+
+	for (std::vector<std::pair<CvPoint, CvPoint> >::const_iterator it =
+			bb.begin(); it != bb.end(); it++) {
+		cvRectangle(output, it->first, it->second, cvScalar(0, 0, 255));
+	}
 }
 
 void renderChains(IplImage * SWTImage,
@@ -303,9 +313,93 @@ void renderChains(IplImage * SWTImage,
 	cvReleaseImage(&outTemp);
 }
 
+/* past the time budget: log the stage reached, no further text is detected */
+static bool budgetExceeded(const struct TextDetectionParams &params,
+		const char *stage) {
+	if (!params.deadline || !params.deadline->expired())
+		return false;
+	LOGL(LOG_CHAINS, "Time budget exceeded " << stage << ", stop text detection");
+	return true;
+}
+
+void cannyFromGradient(IplImage * gradientX, IplImage * gradientY,
+		double lowThreshold, double highThreshold, IplImage * edgeImage) {
+	cv::Mat dx(gradientX), dy(gradientY), edges(edgeImage);
+	const float tan22 = tan(PI / 8), tan67 = tan(3 * PI / 8);
+	float low = lowThreshold * CANNY_GRADIENT_SCALE;
+	float high = highThreshold * CANNY_GRADIENT_SCALE;
+
+	cv::Mat mag = cv::abs(dx) + cv::abs(dy);
+
+	/* non-maximum suppression along the gradient direction */
+	std::vector<Point2d> stack;
+	edges = cv::Scalar(0);
+	for (int row = 1; row < mag.rows - 1; row++) {
+		const float *gx = dx.ptr<float>(row);
+		const float *gy = dy.ptr<float>(row);
+		const float *m = mag.ptr<float>(row);
+		const float *above = mag.ptr<float>(row - 1);
+		const float *below = mag.ptr<float>(row + 1);
+		uchar *e = edges.ptr<uchar>(row);
+		for (int col = 1; col < mag.cols - 1; col++) {
+			float v = m[col];
+			if (v <= low)
+				continue;
+			float ax = fabs(gx[col]), ay = fabs(gy[col]);
+			float prev, next;
+			if (ay <= ax * tan22) {
+				prev = m[col - 1];
+				next = m[col + 1];
+			} else if (ay > ax * tan67) {
+				prev = above[col];
+				next = below[col];
+			} else if ((gx[col] > 0) == (gy[col] > 0)) {
+				prev = above[col - 1];
+				next = below[col + 1];
+			} else {
+				prev = above[col + 1];
+				next = below[col - 1];
+			}
+			if ((v > prev) && (v >= next)) {
+				if (v > high) {
+					e[col] = CANNY_EDGE;
+					Point2d p = { col, row, 0 };
+					stack.push_back(p);
+				} else {
+					e[col] = CANNY_WEAK;
+				}
+			}
+		}
+	}
+
+	/* hysteresis: keep weak edges connected to a strong one */
+	while (!stack.empty()) {
+		Point2d p = stack.back();
+		stack.pop_back();
+		for (int y = p.y - 1; y <= p.y + 1; y++) {
+			uchar *e = edges.ptr<uchar>(y);
+			for (int x = p.x - 1; x <= p.x + 1; x++) {
+				if (e[x] == CANNY_WEAK) {
+					e[x] = CANNY_EDGE;
+					Point2d q = { x, y, 0 };
+					stack.push_back(q);
+				}
+			}
+		}
+	}
+	for (int row = 0; row < edges.rows; row++) {
+		uchar *e = edges.ptr<uchar>(row);
+		for (int col = 0; col < edges.cols; col++) {
+			if (e[col] == CANNY_WEAK)
+				e[col] = 0;
+		}
+	}
+}
+
 namespace textdetection {
 
-TextDetector::TextDetector()
+TextDetector::TextDetector() :
+		debugImages(true)
 {
 }
 
@@ -323,12 +417,6 @@ void TextDetector::detect(IplImage * input,
 	// Convert to grayscale
 	IplImage * grayImage = cvCreateImage(cvGetSize(input), IPL_DEPTH_8U, 1);
 	cvCvtColor(input, grayImage, CV_RGB2GRAY);
-	// Create Canny Image
-	double threshold_low = 175;
-	double threshold_high = 320;
-	IplImage * edgeImage = cvCreateImage(cvGetSize(input), IPL_DEPTH_8U, 1);
-	cvCanny(grayImage, edgeImage, threshold_low, threshold_high, 3);
-	cvSaveImage("canny.png", edgeImage);
 
 	// Create gradient X, gradient Y
 	IplImage * gaussianImage = cvCreateImage(cvGetSize(input), IPL_DEPTH_32F,
@@ -339,12 +427,18 @@ void TextDetector::detect(IplImage * input,
 	IplImage * gradientY = cvCreateImage(cvGetSize(input), IPL_DEPTH_32F, 1);
 	cvSobel(gaussianImage, gradientX, 1, 0, CV_SCHARR);
 	cvSobel(gaussianImage, gradientY, 0, 1, CV_SCHARR);
+
+	// Create Canny Image from the same gradient
+	IplImage * edgeImage = cvCreateImage(cvGetSize(input), IPL_DEPTH_8U, 1);
+	cannyFromGradient(gradientX, gradientY, params.cannyLow, params.cannyHigh,
+			edgeImage);
+	if (debugImages)
+		cvSaveImage("canny.png", edgeImage);
+
 	cvSmooth(gradientX, gradientX, 3, 3);
 	cvSmooth(gradientY, gradientY, 3, 3);
 	cvReleaseImage(&gaussianImage);
 
-	// Calculate SWT and return ray vectors
-	std::vector<Ray> rays;
 	IplImage * SWTImage = cvCreateImage(cvGetSize(input), IPL_DEPTH_32F, 1);
 	for (int row = 0; row < input->height; row++) {
 		float* ptr = (float*) (SWTImage->imageData + row * SWTImage->widthStep);
@@ -352,51 +446,80 @@ void TextDetector::detect(IplImage * input,
 			*ptr++ = -1;
 		}
 	}
-	strokeWidthTransform(edgeImage, gradientX, gradientY, params, SWTImage,
-			rays);
-	cvSaveImage("SWT_0.png", SWTImage);
-	SWTMedianFilter(SWTImage, rays);
-	cvSaveImage("SWT_1.png", SWTImage);
-
-	IplImage * output2 = cvCreateImage(cvGetSize(input), IPL_DEPTH_32F, 1);
-	normalizeImage(SWTImage, output2);
-	cvSaveImage("SWT_2.png", output2);
-	IplImage * saveSWT = cvCreateImage(cvGetSize(input), IPL_DEPTH_8U, 1);
-	cvConvertScale(output2, saveSWT, 255, 0);
-	cvSaveImage("SWT.png", saveSWT);
-	cvReleaseImage(&output2);
-	cvReleaseImage(&saveSWT);
-
-	// Calculate legally connected components from SWT and gradient image.
-	// return type is a vector of vectors, where each outer vector is a component and
-	// the inner vector contains the (y,x) of each pixel in that component.
-	std::vector<std::vector<Point2d> > components =
-			findLegallyConnectedComponents(SWTImage, rays);
-
-	// Filter the components
-	std::vector<std::vector<Point2d> > validComponents;
-	std::vector<Point2dFloat> compCenters;
-	std::vector<float> compMedians;
-	std::vector<Point2d> compDimensions;
-	filterComponents(SWTImage, components, validComponents, compCenters,
-			compMedians, compDimensions, compBB, params);
-
-	IplImage * output3 = cvCreateImage(cvGetSize(input), 8U, 3);
-	renderComponentsWithBoxes(SWTImage, validComponents, compBB, output3);
-	cvSaveImage("components.png", output3);
-	cvReleaseImage ( &output3 );
-
-	// Make chains of components
-	chains = makeChains(input, validComponents, compCenters, compMedians,
-			compDimensions, params);
-
-	IplImage * output = cvCreateImage(cvGetSize(grayImage), IPL_DEPTH_8U, 3);
-	renderChainsWithBoxes(SWTImage, validComponents, chains, compBB, chainBB, output);
-	cvSaveImage("text-boxes.png", output);
-
-
-
-	cvReleaseImage(&output);
+
+	/* stages until the time budget is exceeded */
+	do {
+		if (budgetExceeded(params, "after edge detection"))
+			break;
+
+		// Calculate SWT and return ray vectors
+		std::vector<Ray> rays;
+		strokeWidthTransform(edgeImage, gradientX, gradientY, params, SWTImage,
+				rays);
+		if (debugImages)
+			cvSaveImage("SWT_0.png", SWTImage);
+		if (budgetExceeded(params, "after SWT"))
+			break;
+		SWTMedianFilter(SWTImage, rays);
+		if (budgetExceeded(params, "after SWT median filter"))
+			break;
+		if (debugImages) {
+			cvSaveImage("SWT_1.png", SWTImage);
+
+			IplImage * output2 = cvCreateImage(cvGetSize(input), IPL_DEPTH_32F, 1);
+			normalizeImage(SWTImage, output2);
+			cvSaveImage("SWT_2.png", output2);
+			IplImage * saveSWT = cvCreateImage(cvGetSize(input), IPL_DEPTH_8U, 1);
+			cvConvertScale(output2, saveSWT, 255, 0);
+			cvSaveImage("SWT.png", saveSWT);
+			cvReleaseImage(&output2);
+			cvReleaseImage(&saveSWT);
+		}
+
+		// Calculate legally connected components from SWT and gradient image.
+		// return type is a vector of vectors, where each outer vector is a component and
+		// the inner vector contains the (y,x) of each pixel in that component.
+		// Stroke width, colour and extent of each component are accumulated
+		// in the same pass.
+		std::vector<ComponentSums> compSums;
+		std::vector<std::vector<Point2d> > components =
+				findLegallyConnectedComponents(SWTImage, input, rays, compSums);
+
+		// Filter the components
+		std::vector<std::vector<Point2d> > validComponents;
+		std::vector<Point2dFloat> compCenters;
+		std::vector<float> compMedians;
+		std::vector<Point2d> compDimensions;
+		std::vector<Point3dFloat> compColors;
+		filterComponents(SWTImage, components, compSums, validComponents,
+				compCenters, compMedians, compDimensions, compBB, compColors,
+				params);
+
+		if (debugImages) {
+			IplImage * output3 = cvCreateImage(cvGetSize(input), 8U, 3);
+			renderComponentsWithBoxes(SWTImage, validComponents, compBB, output3);
+			cvSaveImage("components.png", output3);
+			cvReleaseImage ( &output3 );
+		}
+
+		if (budgetExceeded(params, "after component filtering"))
+			break;
+
+		// Make chains of components
+		chains = makeChains(validComponents, compCenters, compMedians,
+				compDimensions, compColors, params);
+		chainBB = findBoundingBoxes(chains, compBB, cvGetSize(input));
+
+		// Rendering only consumes the chains and their boxes
+		if (debugImages) {
+			IplImage * output = cvCreateImage(cvGetSize(grayImage), IPL_DEPTH_8U, 3);
+			renderChainsWithBoxes(SWTImage, validComponents, chains, chainBB,
+					output);
+			cvSaveImage("text-boxes.png", output);
+			cvReleaseImage(&output);
+		}
+	} while (0);
+
 	cvReleaseImage(&gradientX);
 	cvReleaseImage(&gradientY);
 	cvReleaseImage(&SWTImage);
@@ -520,22 +643,61 @@ void strokeWidthTransform(IplImage * edgeImage, IplImage * gradientX,
 
 }
 
-void SWTMedianFilter(IplImage * SWTImage, std::vector<Ray> & rays) {
-	for (std::vector<Ray>::iterator rit = rays.begin(); rit != rays.end();
-			rit++) {
-		for (std::vector<Point2d>::iterator pit = rit->points.begin();
-				pit != rit->points.end(); pit++) {
-			pit->SWT = CV_IMAGE_ELEM(SWTImage, float, pit->y, pit->x);
-		}
-		std::sort(rit->points.begin(), rit->points.end(), &Point2dSort);
-		float median = (rit->points[rit->points.size() / 2]).SWT;
-		for (std::vector<Point2d>::iterator pit = rit->points.begin();
-				pit != rit->points.end(); pit++) {
-			CV_IMAGE_ELEM(SWTImage, float, pit->y, pit->x) = std::min(pit->SWT,
-					median);
+/* rays up to this number of points are filtered without allocation */
+#define RAY_MEDIAN_BUFFER 256
+
+/**
+ * Median stroke width of each ray, read from the SWT image of the first
+ * pass. The image is not modified, so that rays can be processed in any
+ * order.
+ */
+class RayMedianInvoker: public cv::ParallelLoopBody {
+public:
+	RayMedianInvoker(const IplImage * _SWTImage, const std::vector<Ray>& _rays,
+			std::vector<float>& _medians) :
+			SWTImage(_SWTImage), rays(_rays), medians(_medians) {
+	}
+
+	virtual void operator()(const cv::Range& range) const {
+		float buffer[RAY_MEDIAN_BUFFER];
+		std::vector<float> longRay;
+		for (int i = range.start; i < range.end; i++) {
+			const std::vector<Point2d> &points = rays[i].points;
+			float *values = buffer;
+			if (points.size() > RAY_MEDIAN_BUFFER) {
+				longRay.resize(points.size());
+				values = &longRay[0];
+			}
+			for (unsigned int k = 0; k < points.size(); k++) {
+				values[k] = CV_IMAGE_ELEM(SWTImage, float, points[k].y,
+						points[k].x);
+			}
+			float *median = values + points.size() / 2;
+			std::nth_element(values, median, values + points.size());
+			medians[i] = *median;
 		}
 	}
 
+private:
+	const IplImage * SWTImage;
+	const std::vector<Ray>& rays;
+	std::vector<float>& medians;
+};
+
+void SWTMedianFilter(IplImage * SWTImage, std::vector<Ray> & rays) {
+	std::vector<float> medians(rays.size());
+	cv::parallel_for_(cv::Range(0, rays.size()),
+			RayMedianInvoker(SWTImage, rays, medians));
+
+	/* rays cross each other: each pixel keeps the lowest median */
+	for (unsigned int i = 0; i < rays.size(); i++) {
+		const std::vector<Point2d> &points = rays[i].points;
+		for (std::vector<Point2d>::const_iterator pit = points.begin();
+				pit != points.end(); pit++) {
+			float &swt = CV_IMAGE_ELEM(SWTImage, float, pit->y, pit->x);
+			swt = std::min(swt, medians[i]);
+		}
+	}
 }
 
 bool Point2dSort(const Point2d &lhs, const Point2d &rhs) {
@@ -543,7 +705,8 @@ bool Point2dSort(const Point2d &lhs, const Point2d &rhs) {
 }
 
 std::vector<std::vector<Point2d> > findLegallyConnectedComponents(
-		IplImage * SWTImage, std::vector<Ray> &rays) {
+		IplImage * SWTImage, IplImage * colorImage, std::vector<Ray> &rays,
+		std::vector<ComponentSums> &sums) {
 	boost::unordered_map<int, int> map;
 	boost::unordered_map<int, Point2d> revmap;
 
@@ -626,51 +789,58 @@ std::vector<std::vector<Point2d> > findLegallyConnectedComponents(
 		std::vector<Point2d> tmp;
 		components.push_back(tmp);
 	}
+	struct ComponentSums empty = { 0, 0, 0, { 0, 0, 0 }, SWTImage->width,
+			SWTImage->height, 0, 0 };
+	sums.assign(num_comp, empty);
 	for (int j = 0; j < num_vertices; j++) {
 		Point2d p = revmap[j];
 		(components[c[j]]).push_back(p);
+
+		struct ComponentSums &sum = sums[c[j]];
+		float t = CV_IMAGE_ELEM(SWTImage, float, p.y, p.x);
+		sum.count++;
+		sum.swtSum += t;
+		sum.swtSquareSum += t * t;
+		sum.colorSum.x += CV_IMAGE_ELEM(colorImage, unsigned char, p.y, p.x * 3);
+		sum.colorSum.y += CV_IMAGE_ELEM(colorImage, unsigned char, p.y,
+				p.x * 3 + 1);
+		sum.colorSum.z += CV_IMAGE_ELEM(colorImage, unsigned char, p.y,
+				p.x * 3 + 2);
+		sum.minx = std::min(sum.minx, p.x);
+		sum.miny = std::min(sum.miny, p.y);
+		sum.maxx = std::max(sum.maxx, p.x);
+		sum.maxy = std::max(sum.maxy, p.y);
 	}
 
 	return components;
 }
 
 void componentStats(IplImage * SWTImage, const std::vector<Point2d> & component,
-		float & mean, float & variance, float & median, int & minx, int & miny,
-		int & maxx, int & maxy) {
+		const struct ComponentSums & sums, float & mean, float & variance,
+		float & median) {
+	mean = sums.swtSum / sums.count;
+	variance = std::max(0.f, sums.swtSquareSum / sums.count - mean * mean);
+
+	/* only the median needs the stroke widths themselves */
 	std::vector<float> temp;
 	temp.reserve(component.size());
-	mean = 0;
-	variance = 0;
-	minx = 1000000;
-	miny = 1000000;
-	maxx = 0;
-	maxy = 0;
 	for (std::vector<Point2d>::const_iterator it = component.begin();
 			it != component.end(); it++) {
-		float t = CV_IMAGE_ELEM(SWTImage, float, it->y, it->x);
-		mean += t;
-		temp.push_back(t);
-		miny = std::min(miny, it->y);
-		minx = std::min(minx, it->x);
-		maxy = std::max(maxy, it->y);
-		maxx = std::max(maxx, it->x);
+		temp.push_back(CV_IMAGE_ELEM(SWTImage, float, it->y, it->x));
 	}
-	mean = mean / ((float) component.size());
-	for (std::vector<float>::const_iterator it = temp.begin(); it != temp.end();
-			it++) {
-		variance += (*it - mean) * (*it - mean);
-	}
-	variance = variance / ((float) component.size());
-	std::sort(temp.begin(), temp.end());
-	median = temp[temp.size() / 2];
+	std::vector<float>::iterator mid = temp.begin() + temp.size() / 2;
+	std::nth_element(temp.begin(), mid, temp.end());
+	median = *mid;
 }
 #define NO_FILTER
 void filterComponents(IplImage * SWTImage,
 		std::vector<std::vector<Point2d> > & components,
+		const std::vector<ComponentSums> & sums,
 		std::vector<std::vector<Point2d> > & validComponents,
 		std::vector<Point2dFloat> & compCenters,
 		std::vector<float> & compMedians, std::vector<Point2d> & compDimensions,
 		std::vector<std::pair<Point2d, Point2d> > & compBB,
+		std::vector<Point3dFloat> & compColors,
 		const struct TextDetectionParams &params) {
 	validComponents.reserve(components.size());
 	compCenters.reserve(components.size());
@@ -678,13 +848,14 @@ void filterComponents(IplImage * SWTImage,
 	compDimensions.reserve(components.size());
 	// bounding boxes
 	compBB.reserve(components.size());
+	compColors.reserve(components.size());
 	for (std::vector<std::vector<Point2d> >::iterator it = components.begin();
 			it != components.end(); it++) {
+		const struct ComponentSums &sum = sums[it - components.begin()];
 		// compute the stroke width mean, variance, median
 		float mean, variance, median;
-		int minx, miny, maxx, maxy;
-		componentStats(SWTImage, (*it), mean, variance, median, minx, miny,
-				maxx, maxy);
+		componentStats(SWTImage, (*it), sum, mean, variance, median);
+		int minx = sum.minx, miny = sum.miny, maxx = sum.maxx, maxy = sum.maxy;
 #ifndef NO_FILTER
 		// check if variance is less than half the mean
 		if (variance > 0.5 * mean) {
@@ -782,7 +953,13 @@ void filterComponents(IplImage * SWTImage,
 		bb2.y = maxy;
 		std::pair<Point2d, Point2d> pair(bb1, bb2);
 
+		Point3dFloat color;
+		color.x = sum.colorSum.x / sum.count;
+		color.y = sum.colorSum.y / sum.count;
+		color.z = sum.colorSum.z / sum.count;
+
 		compBB.push_back(pair);
+		compColors.push_back(color);
 		compDimensions.push_back(dimensions);
 		compMedians.push_back(median);
 		compCenters.push_back(center);
@@ -793,7 +970,9 @@ void filterComponents(IplImage * SWTImage,
 	std::vector<float> tempMed;
 	std::vector<Point2dFloat> tempCenters;
 	std::vector<std::pair<Point2d, Point2d> > tempBB;
+	std::vector<Point3dFloat> tempColors;
 	tempComp.reserve(validComponents.size());
+	tempColors.reserve(validComponents.size());
 	tempCenters.reserve(validComponents.size());
 	tempDim.reserve(validComponents.size());
 	tempMed.reserve(validComponents.size());
@@ -816,6 +995,7 @@ void filterComponents(IplImage * SWTImage,
 			tempMed.push_back(compMedians[i]);
 			tempDim.push_back(compDimensions[i]);
 			tempBB.push_back(compBB[i]);
+			tempColors.push_back(compColors[i]);
 		}
 	}
 	validComponents = tempComp;
@@ -823,6 +1003,7 @@ void filterComponents(IplImage * SWTImage,
 	compMedians = tempMed;
 	compCenters = tempCenters;
 	compBB = tempBB;
+	compColors = tempColors;
 
 	compDimensions.reserve(tempComp.size());
 	compMedians.reserve(tempComp.size());
@@ -856,63 +1037,39 @@ bool chainSortLength(const Chain &lhs, const Chain &rhs) {
 	return lhs.components.size() > rhs.components.size();
 }
 
-bool includes(std::vector<int> v, std::vector<int> V)
+/* v and V are sorted, without duplicates */
+static bool includes(const std::vector<int> &v, const std::vector<int> &V)
 {
 	if (v.size() > V.size())
 		return false;
-
-	for (int i=0,iend=v.size();i<iend;i++)
-	{
-		int j;
-		int jend = V.size();
-		for (j=0;j<jend;j++)
-		{
-			if (v[i] == V[j])
-				break;
-		}
-		if (j==jend)
-			return false;
-	}
-	return true;
+	return std::includes(V.begin(), V.end(), v.begin(), v.end());
 }
 
-std::vector<Chain> makeChains(IplImage * colorImage,
+std::vector<Chain> makeChains(
 		std::vector<std::vector<Point2d> > & components,
 		std::vector<Point2dFloat> & compCenters,
 		std::vector<float> & compMedians, std::vector<Point2d> & compDimensions,
+		const std::vector<Point3dFloat> & colorAverages,
 		const struct TextDetectionParams &params) {
 	assert(compCenters.size() == components.size());
-	// make vector of color averages
-	std::vector<Point3dFloat> colorAverages;
-	colorAverages.reserve(components.size());
-	for (std::vector<std::vector<Point2d> >::iterator it = components.begin();
-			it != components.end(); it++) {
-		Point3dFloat mean;
-		mean.x = 0;
-		mean.y = 0;
-		mean.z = 0;
-		int num_points = 0;
-		for (std::vector<Point2d>::iterator pit = it->begin(); pit != it->end();
-				pit++) {
-			mean.x += (float) CV_IMAGE_ELEM(colorImage, unsigned char, pit->y,
-					(pit->x) * 3);
-			mean.y += (float) CV_IMAGE_ELEM(colorImage, unsigned char, pit->y,
-					(pit->x) * 3 + 1);
-			mean.z += (float) CV_IMAGE_ELEM(colorImage, unsigned char, pit->y,
-					(pit->x) * 3 + 2);
-			num_points++;
-		}
-		mean.x = mean.x / ((float) num_points);
-		mean.y = mean.y / ((float) num_points);
-		mean.z = mean.z / ((float) num_points);
-		colorAverages.push_back(mean);
-	}
+	assert(colorAverages.size() == components.size());
+	float maxColorDist = params.maxColorDist * params.maxColorDist;
 
 	// form all eligible pairs and calculate the direction of each
 	std::vector<Chain> chains;
 	for (unsigned int i = 0; i < components.size(); i++) {
+		if (params.deadline && params.deadline->expired()) {
+			LOGL(LOG_CHAINS,
+					"Time budget exceeded, stop pairing after " << i << "/" << components.size() << " components");
+			break;
+		}
 		for (unsigned int j = i + 1; j < components.size(); j++) {
-			// TODO add color metric
+			float dr = colorAverages[i].x - colorAverages[j].x;
+			float dg = colorAverages[i].y - colorAverages[j].y;
+			float db = colorAverages[i].z - colorAverages[j].z;
+			float colorDist = dr * dr + dg * dg + db * db;
+			if ((maxColorDist > 0) && (colorDist > maxColorDist))
+				continue;
 			float compMediansRatio = compMedians[i] / compMedians[j];
 			float compDimRatioY = ((float) compDimensions[i].y)
 					/ compDimensions[j].y;
@@ -920,9 +1077,6 @@ std::vector<Chain> makeChains(IplImage * colorImage,
 					/ compDimensions[j].x;
 			float dist = square(compCenters[i].x - compCenters[j].x)
 					+ square(compCenters[i].y - compCenters[j].y);
-			float colorDist = square(colorAverages[i].x - colorAverages[j].x)
-					+ square(colorAverages[i].y - colorAverages[j].y)
-					+ square(colorAverages[i].z - colorAverages[j].z);
 #if 0
 			float maxDim = (float) square(
 					std::max(std::min(compDimensions[i].x, compDimensions[i].y),
@@ -940,7 +1094,7 @@ std::vector<Chain> makeChains(IplImage * colorImage,
 					&& (ratio_within(compDimRatioY, COM_MAX_DIM_RATIO))
 					&& (ratio_within(compDimRatioX, COM_MAX_DIM_RATIO))) {
 
-				if (dist / maxDim < COM_MAX_DIST_RATIO /*&& colorDist < 6000*/) {
+				if (dist / maxDim < COM_MAX_DIST_RATIO) {
 					Chain c;
 					c.p = i;
 					c.q = j;
@@ -986,6 +1140,10 @@ std::vector<Chain> makeChains(IplImage * colorImage,
 	//merge chains
 	int merges = 1;
 	while (merges > 0) {
+		if (params.deadline && params.deadline->expired()) {
+			LOGL(LOG_CHAINS, "Time budget exceeded, stop merging chains");
+			break;
+		}
 		for (unsigned int i = 0; i < chains.size(); i++) {
 			chains[i].merged = false;
 		}
@@ -1227,6 +1385,15 @@ std::vector<Chain> makeChains(IplImage * colorImage,
 		cit->components.end());
 	}
 
+	/* chains holding each component, in increasing order */
+	std::vector<std::vector<int> > compChains(components.size());
+	for (int i=0,iend=chains.size(); i<iend; i++)
+	{
+		const std::vector<int> &comps = chains[i].components;
+		for (unsigned int k = 0; k < comps.size(); k++)
+			compChains[comps[k]].push_back(i);
+	}
+
 	/* now add all chains */
 	for (int i=0,iend=chains.size(); i<iend; i++)
 	{
@@ -1237,12 +1404,22 @@ std::vector<Chain> makeChains(IplImage * colorImage,
 		}
 
 		/* now make sure that chain is not already included
-		 * in another chain */
-		int j;
-		for (j=0; j<iend; j++)
-		{
-			if ( (i!=j) && (includes(chains[i].components, chains[j].components)))
-				break;
+		 * in another chain: such a chain also holds its first component */
+		int j = iend;
+		if (chains[i].components.empty()) {
+			j = (i == 0) ? 1 : 0;
+		} else {
+			const std::vector<int> &candidates =
+					compChains[chains[i].components[0]];
+			for (unsigned int k = 0; k < candidates.size(); k++)
+			{
+				if ((candidates[k] != i)
+						&& includes(chains[i].components,
+								chains[candidates[k]].components)) {
+					j = candidates[k];
+					break;
+				}
+			}
 		}
 		if (j<iend)
 		{
@@ -1256,6 +1433,36 @@ std::vector<Chain> makeChains(IplImage * colorImage,
 
 	chains = newchains;
 
+	/* stroke width and colour consistency of the components of each chain */
+	for (unsigned int i = 0; i < chains.size(); i++) {
+		const std::vector<int> &comps = chains[i].components;
+		float n = comps.size();
+		float swMean = 0, swVar = 0, colorDist = 0;
+		Point3dFloat colorMean = { 0, 0, 0 };
+		for (unsigned int j = 0; j < comps.size(); j++) {
+			swMean += compMedians[comps[j]];
+			colorMean.x += colorAverages[comps[j]].x;
+			colorMean.y += colorAverages[comps[j]].y;
+			colorMean.z += colorAverages[comps[j]].z;
+		}
+		swMean /= n;
+		colorMean.x /= n;
+		colorMean.y /= n;
+		colorMean.z /= n;
+		for (unsigned int j = 0; j < comps.size(); j++) {
+			const Point3dFloat &c = colorAverages[comps[j]];
+			float d = compMedians[comps[j]] - swMean;
+			swVar += d * d;
+			colorDist += sqrt(
+					(c.x - colorMean.x) * (c.x - colorMean.x)
+							+ (c.y - colorMean.y) * (c.y - colorMean.y)
+							+ (c.z - colorMean.z) * (c.z - colorMean.z));
+		}
+		chains[i].strokeWidthSpread =
+				(swMean > 0) ? sqrt(swVar / n) / swMean : 0;
+		chains[i].colorSpread = colorDist / n;
+	}
+
 	/* print chains */
 	for (unsigned int j = 0; j < chains.size(); j++) {
 		LOG(LOG_CHAINS, "Chain" << j <<":");
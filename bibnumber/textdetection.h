@@ -23,6 +23,8 @@
 
 #include <tesseract/baseapi.h>
 
+#include "deadline.h"
+
 struct Point2d {
     int x;
     int y;
@@ -57,6 +59,22 @@ struct TextDetectionParams {
 	unsigned int minChainLen;
 	int modelVerifLenCrit;
 	int modelVerifMinHeight;
+	float cannyLow; /* Canny thresholds, on the gradient of the 8-bit image */
+	float cannyHigh;
+	float maxColorDist; /* between the mean colours of paired components, 0 for none */
+	const deadline::Deadline *deadline; /* per-image time budget, NULL for none */
+};
+
+/* accumulated over the pixels of a component while labeling */
+struct ComponentSums {
+    int count;
+    float swtSum;
+    float swtSquareSum;
+    Point3dFloat colorSum;
+    int minx;
+    int miny;
+    int maxx;
+    int maxy;
 };
 
 struct Chain {
@@ -66,6 +84,8 @@ struct Chain {
     bool merged;
     Point2dFloat direction;
     std::vector<int> components;
+    float strokeWidthSpread; /* std deviation / mean of component stroke widths */
+    float colorSpread; /* mean distance of component colours to their mean */
 };
 
 bool Point2dSort (Point2d const & lhs,
@@ -78,12 +98,24 @@ void strokeWidthTransform (IplImage * edgeImage,
                            IplImage * SWTImage,
                            std::vector<Ray> & rays);
 
+/**
+ * Canny edges (non-maximum suppression and hysteresis) of the gradient
+ * used by the stroke width transform
+ */
+void cannyFromGradient (IplImage * gradientX,
+                        IplImage * gradientY,
+                        double lowThreshold,
+                        double highThreshold,
+                        IplImage * edgeImage);
+
 void SWTMedianFilter (IplImage * SWTImage,
                      std::vector<Ray> & rays);
 
 std::vector< std::vector<Point2d> >
 findLegallyConnectedComponents (IplImage * SWTImage,
-                                std::vector<Ray> & rays);
+                                IplImage * colorImage,
+                                std::vector<Ray> & rays,
+                                std::vector<ComponentSums> & sums);
 
 std::vector< std::vector<Point2d> >
 findLegallyConnectedComponentsRAY (IplImage * SWTImage,
@@ -91,25 +123,34 @@ findLegallyConnectedComponentsRAY (IplImage * SWTImage,
 
 void componentStats(IplImage * SWTImage,
                                         const std::vector<Point2d> & component,
-                                        float & mean, float & variance, float & median,
-                                        int & minx, int & miny, int & maxx, int & maxy);
+                                        const struct ComponentSums & sums,
+                                        float & mean, float & variance, float & median);
 
 void filterComponents(IplImage * SWTImage,
                       std::vector<std::vector<Point2d> > & components,
+                      const std::vector<ComponentSums> & sums,
                       std::vector<std::vector<Point2d> > & validComponents,
                       std::vector<Point2dFloat> & compCenters,
                       std::vector<float> & compMedians,
                       std::vector<Point2d> & compDimensions,
                       std::vector<std::pair<Point2d,Point2d> > & compBB,
+                      std::vector<Point3dFloat> & compColors,
                       const struct TextDetectionParams &params);
 
-std::vector<Chain> makeChains( IplImage * colorImage,
+std::vector<Chain> makeChains(
                  std::vector<std::vector<Point2d> > & components,
                  std::vector<Point2dFloat> & compCenters,
                  std::vector<float> & compMedians,
                  std::vector<Point2d> & compDimensions,
+                 const std::vector<Point3dFloat> & compColors,
                  const struct TextDetectionParams &params);
 
+/* axis-aligned box of each chain, from the boxes of its components */
+std::vector<std::pair<CvPoint, CvPoint> >
+findBoundingBoxes (const std::vector<Chain> & chains,
+                   const std::vector<std::pair<Point2d,Point2d> > & compBB,
+                   CvSize size);
+
 namespace textdetection {
 
 
@@ -122,6 +163,10 @@ public:
 	                    std::vector<Chain> &chains,
 	                    std::vector<std::pair<Point2d, Point2d> > &compBB,
 	                    std::vector<std::pair<CvPoint, CvPoint> > &chainBB);
+	/* save the edge, SWT, component and chain images of each detection */
+	void setDebugImages(bool enable) { debugImages = enable; }
+private:
+	bool debugImages;
 };
 
 }
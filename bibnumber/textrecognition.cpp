@@ -1,8 +1,12 @@
+#include <algorithm>
+#include <cmath>
+
 #include <boost/algorithm/string/trim.hpp>
 
 #include <tesseract/baseapi.h>
 #include <tesseract/strngs.h>
 #include <tesseract/genericvector.h>
+#include <tesseract/resultiterator.h>
 
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
@@ -11,11 +15,22 @@
 #include "train.h"
 
 #include "textrecognition.h"
+#include "fasthog.h"
 #include "log.h"
 #include "stdio.h"
 
 #define PI 3.14159265
 
+/* height of the text passed to Tesseract, borders around it */
+#define OCR_GLYPH_HEIGHT 48
+#define OCR_BORDER 9
+/* radius of the erosion applied to the OCR input, ~5% of its height */
+#define OCR_ERODE_RADIUS 3
+/* chains with this many characters or more get the full length score */
+#define CHAIN_SCORE_MAX_LEN 4
+/* chains read past half of the time budget */
+#define DEGRADED_MAX_CHAINS 5
+
 static bool is_number(const std::string& s) {
 	std::string::const_iterator it = s.begin();
 	while (it != s.end() && std::isdigit(*it))
@@ -99,6 +114,182 @@ cv::Scalar getMSSIM(const cv::Mat& i1, const cv::Mat& i2) {
 	return mssim;
 }
 
+/* chain that was read successfully by OCR */
+struct Candidate {
+	std::string text;
+	cv::Mat bibMat; /* bib region in input image */
+	cv::Mat rotMatrix; /* rotation to horizontal text */
+	cv::Point center;
+	int width;
+	int height;
+	int charWidth;
+	double theta_deg;
+	std::vector<cv::Mat> digits; /* binarised components, in reading order */
+	float confidence; /* OCR word confidence (0-100), negative if unknown */
+	std::vector<float> charConfidences;
+	bool skipChecks; /* confident enough to skip SVM and symmetry checks */
+	bool verify; /* needs SVM verification */
+	float prediction;
+};
+
+/* chain that passed the geometric checks, to be read by OCR */
+struct OcrInput {
+	unsigned int chain;
+	cv::Point center;
+	cv::Mat rotMatrix; /* rotation to horizontal text */
+	double theta_deg;
+	int minHeight; /* of the chain components */
+	std::vector<cv::Mat> digits; /* binarised components, in reading order */
+	cv::Mat ocrMat; /* Tesseract input */
+	std::string text;
+	float confidence; /* OCR word confidence (0-100), negative if unknown */
+	std::vector<float> charConfidences;
+	float score; /* likelihood of being a bib number, higher is better */
+};
+
+static bool ocrInputSort(const struct OcrInput &lhs,
+		const struct OcrInput &rhs) {
+	return lhs.score > rhs.score;
+}
+
+/**
+ * Cheap score of how likely a chain is a bib number, before OCR: rewards
+ * bib-like numbers of characters and consistent stroke widths and colours,
+ * penalises unusual character aspect ratios and chains far from the
+ * horizontal center of the image (where runners usually are)
+ */
+static float chainScore(const Chain& chain,
+		const std::pair<CvPoint, CvPoint>& bb, cv::Size size) {
+	float n = chain.components.size();
+	float width = bb.second.x - bb.first.x;
+	float height = std::max(bb.second.y - bb.first.y, 1);
+	/* width/height of one character, ~0.6 for digits */
+	float aspect = std::max(width / (n * height), 0.01f);
+	float center = (bb.first.x + bb.second.x) / 2.0f;
+
+	float score = std::min(n, (float) CHAIN_SCORE_MAX_LEN) / CHAIN_SCORE_MAX_LEN;
+	score -= chain.strokeWidthSpread;
+	score -= chain.colorSpread / 100;
+	score -= 0.5 * std::fabs(std::log(aspect / 0.6));
+	score -= 0.5 * std::fabs(center - size.width / 2.0f) / size.width;
+	return score;
+}
+
+/**
+ * Collect the text and confidences of the last Tesseract recognition into
+ * ocrInputs[first..]: each word goes to the input whose band
+ * [top, top + OCR image rows) contains the center of the word. Words of the
+ * same input are separated by a space, so that a chain read as several
+ * words is not taken for a single number.
+ */
+static void readResults(tesseract::TessBaseAPI& tess,
+		std::vector<struct OcrInput>& ocrInputs, unsigned int first,
+		const std::vector<int>& top) {
+	tesseract::ResultIterator* it = tess.GetIterator();
+	struct OcrInput *ocrInput = 0;
+
+	if (it == 0)
+		return;
+	do {
+		if (it->Empty(tesseract::RIL_SYMBOL))
+			continue;
+		if (it->IsAtBeginningOf(tesseract::RIL_WORD)) {
+			int x1, y1, x2, y2;
+			ocrInput = 0;
+			if (it->BoundingBox(tesseract::RIL_WORD, &x1, &y1, &x2, &y2)) {
+				int y = (y1 + y2) / 2;
+				for (unsigned int i = first; i < ocrInputs.size(); i++) {
+					if ((y >= top[i - first])
+							&& (y < top[i - first] + ocrInputs[i].ocrMat.rows)) {
+						ocrInput = &ocrInputs[i];
+						break;
+					}
+				}
+			}
+			if (ocrInput != 0) {
+				if (!ocrInput->text.empty())
+					ocrInput->text += ' ';
+				/* a chain split into several words gets the lowest confidence */
+				float confidence = it->Confidence(tesseract::RIL_WORD);
+				if ((ocrInput->confidence < 0)
+						|| (confidence < ocrInput->confidence))
+					ocrInput->confidence = confidence;
+			}
+		}
+		if (ocrInput == 0)
+			continue;
+		char* symbol = it->GetUTF8Text(tesseract::RIL_SYMBOL);
+		if (symbol == 0)
+			continue;
+		ocrInput->text += symbol;
+		ocrInput->charConfidences.push_back(
+				it->Confidence(tesseract::RIL_SYMBOL));
+		delete[] symbol;
+	} while (it->Next(tesseract::RIL_SYMBOL));
+	delete it;
+}
+
+/**
+ * Read the chains with a single Tesseract call: their OCR images are
+ * stacked on one page, separated by blank bands, and each recognised word
+ * is assigned to the chain whose band contains the center of the word
+ */
+static void recognizePage(tesseract::TessBaseAPI& tess,
+		std::vector<struct OcrInput>& ocrInputs) {
+	int width = 0, gap = 0, height = 0;
+	std::vector<int> top(ocrInputs.size());
+
+	for (unsigned int i = 0; i < ocrInputs.size(); i++) {
+		width = std::max(width, ocrInputs[i].ocrMat.cols);
+		gap = std::max(gap, ocrInputs[i].ocrMat.rows / 2);
+	}
+	height = gap;
+	for (unsigned int i = 0; i < ocrInputs.size(); i++) {
+		top[i] = height;
+		height += ocrInputs[i].ocrMat.rows + gap;
+	}
+
+	cv::Mat page = cv::Mat::zeros(height, width + 2 * gap, CV_8UC1);
+	for (unsigned int i = 0; i < ocrInputs.size(); i++) {
+		const cv::Mat &mat = ocrInputs[i].ocrMat;
+		mat.copyTo(page(cv::Rect(gap, top[i], mat.cols, mat.rows)));
+	}
+
+	tess.SetPageSegMode(tesseract::PSM_SINGLE_BLOCK);
+	tess.SetImage((uchar*) page.data, page.cols, page.rows, 1, page.step1());
+	if (tess.Recognize(0) == 0)
+		readResults(tess, ocrInputs, 0, top);
+	tess.SetPageSegMode(tesseract::PSM_SINGLE_WORD);
+}
+
+/**
+ * Compute one HOG descriptor per candidate to verify into the rows of
+ * descriptors
+ */
+class DescriptorInvoker: public cv::ParallelLoopBody {
+public:
+	DescriptorInvoker(const std::vector<struct Candidate>& _candidates,
+			const std::vector<unsigned int>& _todo, cv::Mat& _descriptors) :
+			candidates(_candidates), todo(_todo), descriptors(_descriptors) {
+	}
+
+	virtual void operator()(const cv::Range& range) const {
+		fasthog::FastHOG fastHog;
+		std::vector<float> descriptor;
+		for (int i = range.start; i < range.end; i++) {
+			/* resized to HOG window dimensions */
+			fastHog.compute(candidates[todo[i]].bibMat, descriptor);
+			std::copy(descriptor.begin(), descriptor.end(),
+					descriptors.ptr<float>(i));
+		}
+	}
+
+private:
+	const std::vector<struct Candidate>& candidates;
+	const std::vector<unsigned int>& todo;
+	cv::Mat& descriptors;
+};
+
 namespace textrecognition {
 
 TextRecognizer::TextRecognizer() {
@@ -123,12 +314,29 @@ TextRecognizer::TextRecognizer() {
 #if 0
 	tess.SetVariable("tessedit_char_whitelist", "0123456789");
 #endif
-	tess.SetVariable("tessedit_write_images", "true");
 	tess.SetPageSegMode(tesseract::PSM_SINGLE_WORD);
 
 	/* initialize sequence ids */
 	bsid = 0;
 	dsid = 0;
+
+	erodeKernel = cv::getStructuringElement(cv::MORPH_ELLIPSE,
+			cv::Size(2 * OCR_ERODE_RADIUS + 1, 2 * OCR_ERODE_RADIUS + 1),
+			cv::Point(OCR_ERODE_RADIUS, OCR_ERODE_RADIUS));
+
+	ocrMode = OCR_CHAIN;
+	setDebugImages(true);
+	maxOcrChains = 0;
+	skipChecksConfidence = 0;
+	skipChecksMinLength = 0;
+	stats.calls = 0;
+	stats.chains = 0;
+	stats.seconds = 0;
+	stats.dropped = 0;
+}
+
+int TextRecognizer::loadDigitModel(std::string filename) {
+	return digitClassifier.load(filename);
 }
 
 TextRecognizer::~TextRecognizer(void) {
@@ -136,17 +344,43 @@ TextRecognizer::~TextRecognizer(void) {
 	tess.End();
 }
 
+void TextRecognizer::setDebugImages(bool enable) {
+	debugImages = enable;
+	/* Tesseract saves its own input too */
+	tess.SetVariable("tessedit_write_images", enable ? "true" : "false");
+}
+
 int TextRecognizer::recognize(IplImage *input,
 		const struct TextDetectionParams &params, std::string svmModel,
 		std::vector<Chain> &chains,
 		std::vector<std::pair<Point2d, Point2d> > &compBB,
 		std::vector<std::pair<CvPoint, CvPoint> > &chainBB,
-		std::vector<std::string>& text) {
+		std::vector<std::string>& text,
+		std::vector<struct OcrConfidence>& confidences) {
+
+	/* load SVM model once */
+	if ((!svmModel.empty()) && (svmModel != modelFile)) {
+		if (model.load(svmModel) < 0) {
+			std::cerr << "ERROR: Could not load SVM model " << svmModel
+					<< std::endl;
+			model = linearsvm::LinearModel();
+		}
+		modelFile = svmModel;
+	}
+
+	cv::HOGDescriptor hog = fasthog::FastHOG::descriptor();
+	/* chains prepared for OCR */
+	std::vector<struct OcrInput> ocrInputs;
+	/* chains that passed OCR, pending SVM verification and symmetry check */
+	std::vector<struct Candidate> candidates;
 
 	// Convert to grayscale
 	IplImage * grayImage = cvCreateImage(cvGetSize(input), IPL_DEPTH_8U, 1);
 	cvCvtColor(input, grayImage, CV_RGB2GRAY);
 
+	int64 ocrTicks = 0;
+	/* chains that passed the geometric checks */
+	std::vector<struct OcrInput> chainInputs;
 	for (unsigned int i = 0; i < chainBB.size(); i++) {
 		cv::Point center = cv::Point(
 				(chainBB[i].first.x + chainBB[i].second.x) / 2,
@@ -192,13 +426,65 @@ int TextRecognizer::recognize(IplImage *input,
 		LOGL(LOG_TXT_ORIENT,
 				"Chain #" << i << " Angle: " << theta_deg << " degrees");
 
-		/* create copy of input image including only the selected components */
-		cv::Mat inputMat = cv::Mat(input);
+		struct OcrInput ocrInput;
+		ocrInput.chain = i;
+		ocrInput.center = center;
+		ocrInput.theta_deg = theta_deg;
+		ocrInput.minHeight = minHeight;
+		ocrInput.confidence = -1;
+		ocrInput.score = chainScore(chains[i], chainBB[i],
+				cv::Size(input->width, input->height));
+		LOGL(LOG_CHAINS, "Chain #" << i << " score=" << ocrInput.score);
+		chainInputs.push_back(ocrInput);
+	}
+
+	/* read the most promising chains first, up to the OCR budget */
+	std::stable_sort(chainInputs.begin(), chainInputs.end(), ocrInputSort);
+	for (unsigned int k = 0; k < chainInputs.size(); k++) {
+		if (params.deadline && params.deadline->expired()) {
+			LOGL(LOG_TEXTREC,
+					"Time budget exceeded, dropped " << chainInputs.size() - k << " chains");
+			break;
+		}
+		if ((maxOcrChains > 0) && (ocrInputs.size() >= maxOcrChains)) {
+			unsigned int dropped = chainInputs.size() - k;
+			LOGL(LOG_TEXTREC,
+					"OCR budget reached, dropped " << dropped << " chains");
+			stats.dropped += dropped;
+			break;
+		}
+		if ((ocrInputs.size() >= DEGRADED_MAX_CHAINS) && params.deadline
+				&& params.deadline->softExpired()) {
+			LOGL(LOG_TEXTREC,
+					"Half of the time budget exceeded, dropped " << chainInputs.size() - k << " chains");
+			break;
+		}
+		struct OcrInput ocrInput = chainInputs[k];
+		unsigned int i = ocrInput.chain;
+
+		/* copy of the selected components into a buffer centred on the
+		 * chain, large enough to hold them at any rotation about the centre */
 		cv::Mat grayMat = cv::Mat(grayImage);
-		cv::Mat componentsImg = cv::Mat::zeros(grayMat.rows, grayMat.cols,
-				grayMat.type());
+		int radius = 0;
+		for (unsigned int j = 0; j < chains[i].components.size(); j++) {
+			const std::pair<Point2d, Point2d>& bb =
+					compBB[chains[i].components[j]];
+			/* farthest corner from the centre */
+			int dx = std::max(ocrInput.center.x - bb.first.x,
+					bb.second.x - ocrInput.center.x);
+			int dy = std::max(ocrInput.center.y - bb.first.y,
+					bb.second.y - ocrInput.center.y);
+			radius = std::max(radius,
+					cvCeil(std::sqrt((double) (dx * dx + dy * dy))) + 1);
+		}
+		cv::Point origin = ocrInput.center - cv::Point(radius, radius);
+		chainBuf.create(2 * radius + 1, 2 * radius + 1, CV_8UC1);
+		chainBuf = cv::Scalar(0);
 
 		std::vector<cv::Point> compCoords;
+		/* position of each component along the chain direction */
+		std::vector<std::pair<double, unsigned int> > order;
+		std::vector<cv::Mat> digits;
 
 		for (unsigned int j = 0; j < chains[i].components.size(); j++) {
 			int component_id = chains[i].components[j];
@@ -210,18 +496,11 @@ int TextRecognizer::recognize(IplImage *input,
 							- compBB[component_id].first.y);
 			cv::Mat componentRoi = grayMat(roi);
 
-			compCoords.push_back(
-					cv::Point(compBB[component_id].first.x,
-							compBB[component_id].first.y));
-			compCoords.push_back(
-					cv::Point(compBB[component_id].second.x,
-							compBB[component_id].second.y));
-			compCoords.push_back(
-					cv::Point(compBB[component_id].first.x,
-							compBB[component_id].second.y));
-			compCoords.push_back(
-					cv::Point(compBB[component_id].second.x,
-							compBB[component_id].first.y));
+			/* corners, in buffer coordinates */
+			compCoords.push_back(roi.tl() - origin);
+			compCoords.push_back(roi.br() - origin);
+			compCoords.push_back(cv::Point(roi.x, roi.y + roi.height) - origin);
+			compCoords.push_back(cv::Point(roi.x + roi.width, roi.y) - origin);
 
 			cv::Mat thresholded;
 			cv::threshold(componentRoi, thresholded, 0 // the value doesn't matter for Otsu thresholding
@@ -233,212 +512,324 @@ int TextRecognizer::recognize(IplImage *input,
 			std::cout << "mu02=" << mu.mu02 << " mu11=" << mu.mu11 << " skew="
 			<< mu.mu11 / mu.mu02 << std::endl;
 #endif
-			cv::imwrite("thresholded.png", thresholded);
-
-			cv::threshold(componentRoi, componentsImg(roi), 0 // the value doesn't matter for Otsu thresholding
-					, 255 // we could choose any non-zero value. 255 (white) makes it easy to see the binary image
-					, cv::THRESH_OTSU | cv::THRESH_BINARY_INV);
+			if (debugImages)
+				cv::imwrite("thresholded.png", thresholded);
+			order.push_back(
+					std::make_pair(
+							(roi.x + roi.width / 2.0) * chains[i].direction.x
+									+ (roi.y + roi.height / 2.0)
+											* chains[i].direction.y, j));
+			digits.push_back(thresholded);
+			thresholded.copyTo(chainBuf(roi - origin));
+		}
+		if (debugImages)
+			cv::imwrite("bib-components.png", chainBuf);
+
+		ocrInput.rotMatrix = cv::getRotationMatrix2D(ocrInput.center,
+				ocrInput.theta_deg, 1.0);
+		/* components in reading order */
+		std::sort(order.begin(), order.end());
+		for (unsigned int j = 0; j < order.size(); j++)
+			ocrInput.digits.push_back(digits[order[j].second]);
+
+		if (!digitClassifier.empty()) {
+			/* classified below, together with the other chains */
+			ocrInputs.push_back(ocrInput);
+			continue;
 		}
-		cv::imwrite("bib-components.png", componentsImg);
-
-		cv::Mat rotMatrix = cv::getRotationMatrix2D(center, theta_deg, 1.0);
 
-		cv::Mat rotatedMat = cv::Mat::zeros(grayMat.rows, grayMat.cols,
-				grayMat.type());
-		cv::warpAffine(componentsImg, rotatedMat, rotMatrix, rotatedMat.size());
-		cv::imwrite("bib-rotated.png", rotatedMat);
+		/* same rotation, about the centre of the buffer */
+		cv::Mat bufRotMatrix = cv::getRotationMatrix2D(
+				cv::Point(radius, radius), ocrInput.theta_deg, 1.0);
+		cv::warpAffine(chainBuf, rotatedBuf, bufRotMatrix, chainBuf.size());
+		if (debugImages)
+			cv::imwrite("bib-rotated.png", rotatedBuf);
 
 		/* rotate each component coordinates */
-		const int border = 3;
-		cv::transform(compCoords, compCoords, rotMatrix);
+		cv::transform(compCoords, compCoords, bufRotMatrix);
 		/* find bounding box of rotated components */
-		cv::Rect roi = getBoundingBox(compCoords,
-				cv::Size(input->width, input->height));
-		/* ROI area can be null if outside of clipping area */
+		cv::Rect roi = getBoundingBox(compCoords, rotatedBuf.size());
+		/* ROI area can be null for degenerate components */
 		if ((roi.width == 0) || (roi.height == 0))
 			continue;
 		LOGL(LOG_TEXTREC, "ROI = " << roi);
-		cv::Mat mat = cv::Mat::zeros(roi.height + 2 * border,
-				roi.width + 2 * border, grayMat.type());
-		cv::Mat tmp = rotatedMat(roi);
-		/* copy bounded box from rotated mat to new mat with borders - borders are needed
-		 * to improve OCR success rate
+		/* scale bounded box to OCR glyph height into a mat with borders -
+		 * borders are needed to improve OCR success rate
 		 */
-		tmp.copyTo(
-				mat(
-						cv::Rect(cv::Point(border, border),
-								cv::Point(roi.width + border,
-										roi.height + border))));
-
-		/* resize image to improve OCR success rate */
-		float upscale = 3.0;
-		cv::resize(mat, mat, cvSize(0, 0), upscale, upscale);
+		cv::Size size(
+				std::max(1, roi.width * OCR_GLYPH_HEIGHT / roi.height),
+				OCR_GLYPH_HEIGHT);
+		ocrBuf.create(size.height + 2 * OCR_BORDER,
+				size.width + 2 * OCR_BORDER, CV_8UC1);
+		ocrBuf = cv::Scalar(0);
+		cv::resize(rotatedBuf(roi),
+				ocrBuf(cv::Rect(cv::Point(OCR_BORDER, OCR_BORDER), size)),
+				size);
 		/* erode text to get rid of thin joints */
-		int s = (int) (0.05 * mat.rows); /* 5% of up-scaled size) */
-		cv::Mat elem = cv::getStructuringElement(cv::MORPH_ELLIPSE,
-				cv::Size(2 * s + 1, 2 * s + 1), cv::Point(s, s));
-		cv::erode(mat, mat, elem);
-		cv::imwrite("bib-tess-input.png", mat);
+		cv::erode(ocrBuf, ocrMat, erodeKernel);
+		if (debugImages)
+			cv::imwrite("bib-tess-input.png", ocrMat);
+		cv::Mat mat = ocrMat;
+
+		/* page OCR keeps all chains until the end */
+		ocrInput.ocrMat = (ocrMode == OCR_PAGE) ? mat.clone() : mat;
+		ocrInputs.push_back(ocrInput);
+		if (ocrMode == OCR_PAGE) {
+			/* read below, together with the other chains */
+			continue;
+		}
 
 		// Pass it to Tesseract API
+		int64 t = cv::getTickCount();
 		tess.SetImage((uchar*) mat.data, mat.cols, mat.rows, 1, mat.step1());
-		// Get the text
-		char* out = tess.GetUTF8Text();
-		do {
-			if (strlen(out) == 0) {
-				break;
-			}
-			std::string s_out(out);
-			boost::algorithm::trim(s_out);
+		// Get the text and confidences
+		if (tess.Recognize(0) == 0)
+			readResults(tess, ocrInputs, ocrInputs.size() - 1,
+					std::vector<int>(1, 0));
+		ocrTicks += cv::getTickCount() - t;
+		stats.calls++;
+	}
 
-			if (s_out.size() != chains[i].components.size()) {
-				LOGL(LOG_TEXTREC,
-						"Text size mismatch: expected " << chains[i].components.size() << " digits, got '" << s_out << "' (" << s_out.size() << " digits)");
-				break;
-			}
-			/* if first character is a '0' we have a partially occluded number */
-			if (s_out[0] == '0') {
-				LOGL(LOG_TEXTREC, "Text begins with '0' (partially occluded)");
-				break;
+	cvReleaseImage(&grayImage);
+
+	if (digitClassifier.empty() && (ocrMode == OCR_PAGE)
+			&& !ocrInputs.empty()) {
+		int64 t = cv::getTickCount();
+		recognizePage(tess, ocrInputs);
+		ocrTicks += cv::getTickCount() - t;
+		stats.calls++;
+	}
+
+	if (!digitClassifier.empty()) {
+		/* classify the components of all chains at once */
+		std::vector<cv::Mat> digits;
+		std::string digitText;
+		std::vector<float> scores;
+		for (unsigned int i = 0; i < ocrInputs.size(); i++)
+			digits.insert(digits.end(), ocrInputs[i].digits.begin(),
+					ocrInputs[i].digits.end());
+		int64 t = cv::getTickCount();
+		digitClassifier.classify(digits, digitText, scores);
+		ocrTicks += cv::getTickCount() - t;
+		stats.calls++;
+		for (unsigned int i = 0, first = 0; i < ocrInputs.size(); i++) {
+			ocrInputs[i].text = digitText.substr(first,
+					ocrInputs[i].digits.size());
+			first += ocrInputs[i].digits.size();
+		}
+	}
+	LOGL(LOG_TEXTREC,
+			"OCR of " << ocrInputs.size() << " chains took " << ocrTicks * 1000 / cv::getTickFrequency() << "ms");
+	stats.chains += ocrInputs.size();
+	stats.seconds += ocrTicks / cv::getTickFrequency();
+
+	cv::Mat inputMat = cv::Mat(input);
+	for (unsigned int k = 0; k < ocrInputs.size(); k++) {
+		const struct OcrInput &ocrInput = ocrInputs[k];
+		const std::string &s_out = ocrInput.text;
+		unsigned int i = ocrInput.chain;
+		cv::Point center = ocrInput.center;
+
+		if (s_out.empty())
+			continue;
+
+		if (s_out.size() != chains[i].components.size()) {
+			LOGL(LOG_TEXTREC,
+					"Text size mismatch: expected " << chains[i].components.size() << " digits, got '" << s_out << "' (" << s_out.size() << " digits)");
+			continue;
+		}
+		/* if first character is a '0' we have a partially occluded number */
+		if (s_out[0] == '0') {
+			LOGL(LOG_TEXTREC, "Text begins with '0' (partially occluded)");
+			continue;
+		}
+		if (!is_number(s_out)) {
+			LOGL(LOG_TEXTREC, "Text is not a number ('" << s_out << "')");
+			continue;
+		}
+
+		/* adjust width to size of 6 digits */
+		int charWidth = (chainBB[i].second.x - chainBB[i].first.x)
+				/ s_out.size();
+		int width = 6 * charWidth;
+		/* adjust to 2 width/height aspect ratio */
+		int height = width / 2;
+
+		cv::Rect roi = cv::Rect(center.x - width / 2, center.y - height / 2,
+				width, height);
+		if ((roi.x < 0) || (roi.y < 0) || (roi.x + roi.width >= inputMat.cols)
+				|| (roi.y + roi.height >= inputMat.rows)) {
+			LOGL(LOG_TEXTREC, "Reject as ROI outside boundaries");
+			continue;
+		}
+
+		struct Candidate candidate;
+		candidate.text = s_out;
+		candidate.bibMat = inputMat(roi);
+		candidate.rotMatrix = ocrInput.rotMatrix;
+		candidate.center = center;
+		candidate.width = width;
+		candidate.height = height;
+		candidate.charWidth = charWidth;
+		candidate.theta_deg = ocrInput.theta_deg;
+		candidate.digits = ocrInput.digits;
+		candidate.confidence = ocrInput.confidence;
+		candidate.charConfidences = ocrInput.charConfidences;
+		candidate.verify = false;
+		candidate.prediction = 0;
+
+		/* confident readings of long chains skip SVM verification and symmetry check */
+		candidate.skipChecks = (skipChecksConfidence > 0)
+				&& (ocrInput.confidence >= skipChecksConfidence)
+				&& (s_out.size() >= skipChecksMinLength);
+		LOGL(LOG_TEXTREC,
+				"Read '" << s_out << "' confidence=" << ocrInput.confidence << (candidate.skipChecks ? " (skip checks)" : ""));
+
+		if ((!candidate.skipChecks)
+				&& (s_out.size() <= (unsigned) params.modelVerifLenCrit)) {
+
+			if (svmModel.empty() || model.empty()) {
+				LOGL(LOG_TEXTREC, "Reject " << s_out << " on no model");
+				continue;
 			}
-			if (!is_number(s_out)) {
-				LOGL(LOG_TEXTREC, "Text is not a number ('" << s_out << "')");
-				break;
+
+			if (ocrInput.minHeight < params.modelVerifMinHeight) {
+				LOGL(LOG_TEXTREC, "Reject " << s_out << " on small height");
+				continue;
 			}
 
-			/* adjust width to size of 6 digits */
-			int charWidth = (chainBB[i].second.x - chainBB[i].first.x)
-					/ s_out.size();
-			int width = 6 * charWidth;
-			/* adjust to 2 width/height aspect ratio */
-			int height = width / 2;
-			int midx = center.x;
-			int midy = center.y;
-
-			cv::Rect roi = cv::Rect(midx - width / 2, midy - height / 2, width,
-					height);
-			if ((roi.x >= 0) && (roi.y >= 0)
-					&& (roi.x + roi.width < inputMat.cols)
-					&& (roi.y + roi.height < inputMat.rows)) {
-				cv::Mat bibMat = inputMat(roi);
-
-				if (s_out.size() <= (unsigned) params.modelVerifLenCrit) {
-
-					if (svmModel.empty()) {
-						LOGL(LOG_TEXTREC, "Reject " << s_out << " on no model");
-						break;
-					}
+			if (!model.matches(hog)) {
+				LOGL(LOG_TEXTREC,
+						"Reject " << s_out << " on SVM model/HOG mismatch");
+				continue;
+			}
 
-					if (minHeight < params.modelVerifMinHeight) {
-						LOGL(LOG_TEXTREC,
-								"Reject " << s_out << " on small height");
-						break;
-					}
+			/* verified below, together with the other candidates */
+			candidate.verify = true;
+		}
 
-					/* if we have an SVM Model, predict */
-
-					CvSVM svm;
-					cv::HOGDescriptor hog(cv::Size(128, 64), /* windows size */
-					cv::Size(16, 16), /* block size */
-					cv::Size(8, 8), /* block stride */
-					cv::Size(8, 8), /* cell size */
-					9 /* nbins */
-					);
-					std::vector<float> descriptor;
-
-					/* resize to HOGDescriptor dimensions */
-					cv::Mat resizedMat;
-					cv::resize(bibMat, resizedMat, hog.winSize, 0, 0);
-					hog.compute(resizedMat, descriptor);
-
-					/* load SVM model */
-					svm.load(svmModel.c_str());
-					float prediction = svm.predict(cv::Mat(descriptor).t());
-					LOGL(LOG_SVM, "Prediction=" << prediction);
-					if (prediction < 0.5) {
-						LOGL(LOG_TEXTREC,
-								"Reject " << s_out << " on low SVM prediction");
-						break;
-					}
-				}
+		candidates.push_back(candidate);
+	}
 
-				/* symmetry check */
-				if (   //(i == 4) &&
-						(1)) {
-					cv::Mat inputRotated = cv::Mat::zeros(inputMat.rows,
-							inputMat.cols, inputMat.type());
-					cv::warpAffine(inputMat, inputRotated, rotMatrix,
-							inputRotated.size());
-
-					int minOffset = 0;
-					double min = 1e6;
-					//width = 12 * charWidth;
-					for (int offset = -50; offset < 30; offset += 2) {
-
-						/* resize to HOGDescriptor dimensions */
-						cv::Mat straightMat;
-						cv::Mat flippedMat;
-
-						/* extract shifted ROI */
-						cv::Rect roi = cv::Rect(midx - width / 2 + offset,
-								midy - height / 2, width, height);
-
-						if ((roi.x >= 0) && (roi.y >= 0)
-								&& (roi.x + roi.width < inputMat.cols)
-								&& (roi.y + roi.height < inputMat.rows)) {
-							straightMat = inputRotated(roi);
-							cv::flip(straightMat, flippedMat, 1);
-							cv::Scalar mssimV = getMSSIM(straightMat,
-									flippedMat);
-							double avgMssim = (mssimV.val[0] + mssimV.val[1]
-									+ mssimV.val[2]) * 100 / 3;
-							double dist = 1 / (avgMssim + 1);
-							LOGL(LOG_SYMM_CHECK, "offset=" << offset << " dist=" << dist);
-							if (dist < min) {
-								min = dist;
-								minOffset = offset;
-								cv::imwrite("symm-max.png", straightMat);
-								cv::Mat visualImage;
-							}
-						}
-					}
+	/* if we have an SVM Model, predict all candidates at once */
+	std::vector<unsigned int> toVerify;
+	for (unsigned int i = 0; i < candidates.size(); i++) {
+		if (candidates[i].verify)
+			toVerify.push_back(i);
+	}
+	if (!toVerify.empty()) {
+		cv::Mat descriptors(toVerify.size(), hog.getDescriptorSize(),
+				CV_32FC1);
+		cv::parallel_for_(cv::Range(0, toVerify.size()),
+				DescriptorInvoker(candidates, toVerify, descriptors));
+
+		std::vector<float> predictions;
+		model.predict(descriptors, predictions);
+		for (unsigned int i = 0; i < toVerify.size(); i++)
+			candidates[toVerify[i]].prediction = predictions[i];
+	}
 
-					LOGL(LOG_SYMM_CHECK, "MinOffset = " << minOffset
-							<< " charWidth=" << charWidth);
+	for (unsigned int i = 0; i < candidates.size(); i++) {
+		const struct Candidate &candidate = candidates[i];
+		const std::string &s_out = candidate.text;
+		int midx = candidate.center.x;
+		int midy = candidate.center.y;
+		int width = candidate.width;
+		int height = candidate.height;
+		int charWidth = candidate.charWidth;
+
+		if (candidate.verify) {
+			LOGL(LOG_SVM, "Prediction=" << candidate.prediction);
+			if (candidate.prediction <= 0) {
+				LOGL(LOG_TEXTREC,
+						"Reject " << s_out << " on low SVM prediction");
+				continue;
+			}
+		}
 
-					if (absd(minOffset) > charWidth / 3) {
-						LOGL(LOG_TEXTREC,
-								"Reject " << s_out << " on asymmetry");
-						std::cout << "Reject " << s_out << " on asymmetry"
-								<< std::endl;
-						break;
+		/* symmetry check, skipped first when short of time */
+		if (   //(i == 4) &&
+				(!candidate.skipChecks)
+				&& !(params.deadline && params.deadline->softExpired())) {
+			cv::Mat inputRotated = cv::Mat::zeros(inputMat.rows,
+					inputMat.cols, inputMat.type());
+			cv::warpAffine(inputMat, inputRotated, candidate.rotMatrix,
+					inputRotated.size());
+
+			int minOffset = 0;
+			double min = 1e6;
+			//width = 12 * charWidth;
+			for (int offset = -50; offset < 30; offset += 2) {
+
+				/* resize to HOGDescriptor dimensions */
+				cv::Mat straightMat;
+				cv::Mat flippedMat;
+
+				/* extract shifted ROI */
+				cv::Rect roi = cv::Rect(midx - width / 2 + offset,
+						midy - height / 2, width, height);
+
+				if ((roi.x >= 0) && (roi.y >= 0)
+						&& (roi.x + roi.width < inputMat.cols)
+						&& (roi.y + roi.height < inputMat.rows)) {
+					straightMat = inputRotated(roi);
+					cv::flip(straightMat, flippedMat, 1);
+					cv::Scalar mssimV = getMSSIM(straightMat, flippedMat);
+					double avgMssim = (mssimV.val[0] + mssimV.val[1]
+							+ mssimV.val[2]) * 100 / 3;
+					double dist = 1 / (avgMssim + 1);
+					LOGL(LOG_SYMM_CHECK, "offset=" << offset << " dist=" << dist);
+					if (dist < min) {
+						min = dist;
+						minOffset = offset;
+						if (debugImages)
+							cv::imwrite("symm-max.png", straightMat);
 					}
 				}
+			}
 
-				/* save for training only if orientation is ~horizontal */
-				if (abs(theta_deg) < 7) {
-					char *filename;
-					asprintf(&filename, "bib-%05d-%04d.png", this->bsid++,
-							atoi(out));
-					cv::imwrite(filename, bibMat);
-					free(filename);
-				}
+			LOGL(LOG_SYMM_CHECK, "MinOffset = " << minOffset
+					<< " charWidth=" << charWidth);
 
-			} else {
-				LOGL(LOG_TEXTREC, "Reject as ROI outside boundaries");
-				break;
+			if (absd(minOffset) > charWidth / 3) {
+				LOGL(LOG_TEXTREC, "Reject " << s_out << " on asymmetry");
+				std::cout << "Reject " << s_out << " on asymmetry"
+						<< std::endl;
+				continue;
 			}
+		}
 
-			/* all fine, add this bib number */
-			text.push_back(s_out);
-			LOGL(LOG_TEXTREC, "Bib number: '" << s_out << "'");
+		/* save for training only if orientation is ~horizontal */
+		if (abs(candidate.theta_deg) < 7) {
+			struct cropwriter::CropInfo info;
+			info.source = sourceImage;
+			info.text = s_out;
+			info.box = cv::Rect(midx - width / 2, midy - height / 2, width,
+					height) + sourceOffset;
+			info.angle = candidate.theta_deg;
+			char *stem;
+			asprintf(&stem, "bib-%05d-%04d", this->bsid++,
+					atoi(s_out.c_str()));
+			cropWriter.write(stem, candidate.bibMat, info);
+			free(stem);
+			/* digits read by Tesseract, to train the digit classifier */
+			for (unsigned int j = 0; digitClassifier.empty()
+					&& (j < candidate.digits.size()); j++) {
+				asprintf(&stem, "digit-%05d-%c", this->dsid++, s_out[j]);
+				cropWriter.write(stem, candidate.digits[j], info);
+				free(stem);
+			}
+		}
 
-		} while (0);
-		free(out);
+		/* all fine, add this bib number */
+		struct OcrConfidence confidence;
+		confidence.word = candidate.confidence;
+		confidence.chars = candidate.charConfidences;
+		text.push_back(s_out);
+		confidences.push_back(confidence);
+		LOGL(LOG_TEXTREC, "Bib number: '" << s_out << "'");
 	}
 
-	cvReleaseImage(&grayImage);
-
 	return 0;
 
 }
@@ -6,24 +6,83 @@
 #include "opencv2/imgproc/imgproc.hpp"
 
 #include "textdetection.h"
+#include "linearsvm.h"
+#include "digitclassifier.h"
+#include "cropwriter.h"
 
 namespace textrecognition
 {
+	enum OcrMode {
+		OCR_CHAIN, /* one Tesseract call per chain */
+		OCR_PAGE /* all chains of an image tiled into one Tesseract page */
+	};
+
+	struct OcrStats {
+		unsigned int calls; /* recognition calls */
+		unsigned int chains; /* chains read */
+		double seconds; /* time spent in recognition */
+		unsigned int dropped; /* chains not read because of the OCR budget */
+	};
+
+	/* OCR confidence of a bib number */
+	struct OcrConfidence {
+		float word; /* Tesseract word confidence (0-100), negative if unknown */
+		std::vector<float> chars; /* confidence of each character, if known */
+	};
+
 	class TextRecognizer {
 	public:
 		TextRecognizer(void);
 		~TextRecognizer(void);
+		/* read digits with this classifier instead of Tesseract */
+		int loadDigitModel(std::string filename);
+		void setOcrMode(enum OcrMode mode) { ocrMode = mode; }
+		/* save the intermediate images of recognition */
+		void setDebugImages(bool enable);
+		/* read at most maxChains chains per image, best first, 0 for all */
+		void setOcrBudget(unsigned int maxChains) { maxOcrChains = maxChains; }
+		/* skip SVM and symmetry checks of chains read with this confidence
+		 * and at least minLength characters, 0 to always check */
+		void setSkipChecks(float confidence, unsigned int minLength) {
+			skipChecksConfidence = confidence;
+			skipChecksMinLength = minLength;
+		}
+		const struct OcrStats& getOcrStats(void) const { return stats; }
+		void setCropOutput(const struct cropwriter::CropWriterParams& params) {
+			cropWriter.setParams(params);
+		}
+		/* image file and offset of the region being processed, saved with crops */
+		void setSource(const std::string& image, cv::Point offset) {
+			sourceImage = image;
+			sourceOffset = offset;
+		}
 		int recognize (IplImage *input,
 	   	               const struct TextDetectionParams &params,
 	   	               std::string svmModel,
 		               std::vector<Chain> &chains,
 			           std::vector<std::pair<Point2d, Point2d> > &compBB,
 			           std::vector<std::pair<CvPoint, CvPoint> > &chainBB,
-			           std::vector<std::string>& text);
+			           std::vector<std::string>& text,
+			           std::vector<struct OcrConfidence>& confidences);
 	private:
 		tesseract::TessBaseAPI tess;
+		std::string modelFile; /* file name of loaded SVM model */
+		linearsvm::LinearModel model;
+		digitclassifier::DigitClassifier digitClassifier; /* empty to use Tesseract */
 		int dsid; /* digit sequence id */
 		int bsid; /* bib sequence id */
+		cropwriter::CropWriter cropWriter; /* bib and digit crops, for training */
+		std::string sourceImage;
+		cv::Point sourceOffset;
+		enum OcrMode ocrMode;
+		unsigned int maxOcrChains;
+		float skipChecksConfidence;
+		unsigned int skipChecksMinLength;
+		bool debugImages;
+		struct OcrStats stats; /* accumulated over all images */
+		cv::Mat erodeKernel; /* for OCR input at OCR_GLYPH_HEIGHT */
+		cv::Mat ocrBuf, ocrMat; /* OCR input buffers reused across chains */
+		cv::Mat chainBuf, rotatedBuf; /* components of one chain, reused */
 	};
 
 }
@@ -2,6 +2,10 @@
 #include <string>
 #include <ctime>
 #include <cstdlib>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <map>
 
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
@@ -12,55 +16,636 @@
 
 #include "train.h"
 #include "batch.h"
+#include "log.h"
+#include "featurestore.h"
+#include "linearsvm.h"
+#include "fasthog.h"
+#include "cropwriter.h"
+#include "exif.h"
+#include "imageloader.h"
 
 namespace fs = boost::filesystem;
 
-class LinearSVM: public CvSVM {
+/* hard-negative mining: image pyramid scale factor between levels */
+#define HARD_NEGATIVE_SCALE_STEP (1.2)
+/* hard-negative mining: known bib locations in full images */
+#define BIB_BOXES_FILE "bib-boxes.csv"
+/* hard-negative mining: crop index with the box of each bib in its source */
+#define CROP_INDEX_FILE "crops.csv"
+/* augmentation of positives: maximum rotation (degrees), scaling, brightness
+ * shift and Gaussian blur sigma of a variant */
+#define AUGMENT_MAX_ANGLE (7.0)
+#define AUGMENT_MAX_SCALE (0.1)
+#define AUGMENT_MAX_BRIGHTNESS (30.0)
+#define AUGMENT_MAX_BLUR (1.5)
+
+/**
+ * Generate a random variant of a positive example: rotated and scaled about
+ * its centre, brightness-shifted and blurred
+ */
+static void augment(const cv::Mat& src, cv::Mat& dst, cv::RNG& rng) {
+	double angle = rng.uniform(-AUGMENT_MAX_ANGLE, AUGMENT_MAX_ANGLE);
+	double scale = 1.0 + rng.uniform(-AUGMENT_MAX_SCALE, AUGMENT_MAX_SCALE);
+	double shift = rng.uniform(-AUGMENT_MAX_BRIGHTNESS, AUGMENT_MAX_BRIGHTNESS);
+	double sigma = rng.uniform(0.0, AUGMENT_MAX_BLUR);
+
+	cv::Mat rotMatrix = cv::getRotationMatrix2D(
+			cv::Point2f(src.cols / 2.0f, src.rows / 2.0f), angle, scale);
+	cv::warpAffine(src, dst, rotMatrix, src.size(), cv::INTER_LINEAR,
+			cv::BORDER_REPLICATE);
+	dst.convertTo(dst, -1, 1.0, shift);
+	/* smaller kernels would hardly change the image */
+	if (sigma > 0.5)
+		cv::GaussianBlur(dst, dst, cv::Size(0, 0), sigma);
+}
+
+/**
+ * Seed derived from the file name (FNV-1a), so that the variants of a
+ * positive do not change between runs and can be cached
+ */
+static uint64 fileSeed(const fs::path& path) {
+	std::string name = path.filename().string();
+	unsigned int hash = 2166136261u;
+	for (unsigned int i = 0; i < name.size(); i++) {
+		hash ^= (unsigned char) name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * Decode an image upright, the way the pipeline does, so that the bib boxes
+ * it recorded line up with the pixels
+ */
+static cv::Mat decodeUpright(const std::vector<uchar>& data) {
+	struct exif::ExifInfo exifInfo;
+	cv::Mat imageMat;
+
+	if (data.empty())
+		return imageMat;
+	exif::parse(data, exifInfo);
+	imageMat = cv::imdecode(data, 1);
+	if (!imageMat.empty())
+		exif::orient(imageMat, exifInfo.orientation);
+	return imageMat;
+}
+
+static cv::Mat readUpright(const fs::path& path) {
+	std::vector<uchar> data;
+	double seconds;
+
+	if (imageloader::readFile(path.string(), data, seconds) < 0)
+		return cv::Mat();
+	return decodeUpright(data);
+}
+
+/**
+ * Copy a HOG descriptor into a (preallocated) row of a CV_32FC1 matrix
+ */
+static inline void setDescriptorRow(cv::Mat& data, int row,
+		const std::vector<float>& descriptor) {
+	std::copy(descriptor.begin(), descriptor.end(), data.ptr<float>(row));
+}
+
+/**
+ * Copy the rows of data listed in rows, in that order
+ */
+static cv::Mat selectRows(const cv::Mat& data, const std::vector<int>& rows) {
+	cv::Mat selected(rows.size(), data.cols, data.type());
+	for (unsigned int i = 0; i < rows.size(); i++)
+		data.row(rows[i]).copyTo(selected.row(i));
+	return selected;
+}
+
+/**
+ * Compute descriptors of positive examples in parallel for the files
+ * listed in todo: the example itself followed by its augmented variants,
+ * i.e. 1 + augmentations rows per file. Files are decoded from the
+ * corresponding archive entries, if any. Files that cannot be decoded are
+ * flagged in failed.
+ */
+class PositiveDescriptorInvoker: public cv::ParallelLoopBody {
 public:
-	void getSupportVector(std::vector<float>& support_vector) const;
+	PositiveDescriptorInvoker(const std::vector<fs::path>& _files,
+			const std::vector<struct tar::Entry>& _entries,
+			const std::vector<int>& _todo, unsigned int _augmentations,
+			cv::Mat& _trainingData, std::vector<uchar>& _failed) :
+			files(_files), entries(_entries), todo(_todo), augmentations(
+					_augmentations), trainingData(_trainingData), failed(
+					_failed) {
+	}
+
+	virtual void operator()(const cv::Range& range) const {
+		fasthog::FastHOG fastHog;
+		std::vector<float> descriptor;
+		cv::Mat variant;
+		for (int k = range.start; k < range.end; k++) {
+			int i = todo[k];
+			int first = i * (1 + augmentations);
+			LOGL(LOG_TRAIN, "Opening positive example " << files[i].string());
+			cv::Mat imageMat =
+					entries.empty() ?
+							readUpright(files[i]) :
+							decodeUpright(entries[i].data);
+			if (imageMat.empty()) {
+				std::cerr << "ERROR: Failed to open " << files[i].string()
+						<< std::endl;
+				trainingData.rowRange(first, first + 1 + augmentations) =
+						cv::Scalar(0);
+				failed[i] = 1;
+				continue;
+			}
+			fastHog.compute(imageMat, descriptor);
+			setDescriptorRow(trainingData, first, descriptor);
+
+			cv::RNG rng(fileSeed(files[i]));
+			for (unsigned int j = 1; j <= augmentations; j++) {
+				augment(imageMat, variant, rng);
+				fastHog.compute(variant, descriptor);
+				setDescriptorRow(trainingData, first + j, descriptor);
+			}
+		}
+	}
+
+private:
+	const std::vector<fs::path>& files;
+	const std::vector<struct tar::Entry>& entries;
+	const std::vector<int>& todo;
+	unsigned int augmentations;
+	cv::Mat& trainingData;
+	std::vector<uchar>& failed;
 };
 
-void LinearSVM::getSupportVector(std::vector<float>& support_vector) const {
-
-	int sv_count = get_support_vector_count();
-	const CvSVMDecisionFunc* df = decision_func;
-	const double* alphas = df[0].alpha;
-	double rho = df[0].rho;
-	int var_count = get_var_count();
-	support_vector.resize(var_count, 0);
-	for (unsigned int r = 0; r < (unsigned) sv_count; r++) {
-		float myalpha = alphas[r];
-		const float* v = get_support_vector(r);
-		for (int j = 0; j < var_count; j++, v++) {
-			support_vector[j] += (-myalpha) * (*v);
+/**
+ * Decode each full image listed in todo once and compute the descriptors
+ * of all the random patches sampled from it: nNegatives training rows
+ * starting at row firstRow + i * nNegatives, plus one evaluation patch in
+ * row i of evalData (kept in evalPatches for later inspection). Images that
+ * cannot be decoded are flagged in failed.
+ */
+class NegativeDescriptorInvoker: public cv::ParallelLoopBody {
+public:
+	NegativeDescriptorInvoker(const std::vector<fs::path>& _files,
+			const std::vector<int>& _todo, const cv::HOGDescriptor& _hog,
+			unsigned int _nNegatives, unsigned int _firstRow, uint64 _seed,
+			cv::Mat& _trainingData, cv::Mat& _evalData,
+			std::vector<cv::Mat>& _evalPatches, std::vector<uchar>& _failed) :
+			files(_files), todo(_todo), hog(_hog), nNegatives(_nNegatives), firstRow(
+					_firstRow), seed(_seed), trainingData(_trainingData), evalData(
+					_evalData), evalPatches(_evalPatches), failed(_failed) {
+	}
+
+	virtual void operator()(const cv::Range& range) const {
+		fasthog::FastHOG fastHog;
+		for (int k = range.start; k < range.end; k++) {
+			int i = todo[k];
+			std::vector<float> descriptor;
+			/* one generator per image so results do not depend on scheduling */
+			cv::RNG rng(seed + i);
+
+			LOGL(LOG_TRAIN, "Opening full image " << files[i].string());
+			cv::Mat imageMat = readUpright(files[i]);
+			if ((imageMat.cols <= hog.winSize.width)
+					|| (imageMat.rows <= hog.winSize.height)) {
+				std::cerr << "ERROR: Failed to open " << files[i].string()
+						<< std::endl;
+				trainingData.rowRange(firstRow + i * nNegatives,
+						firstRow + (i + 1) * nNegatives) = cv::Scalar(0);
+				evalData.row(i) = cv::Scalar(0);
+				failed[i] = 1;
+				continue;
+			}
+
+			for (unsigned int j = 0; j <= nNegatives; j++) {
+				int x = rng.uniform(0, imageMat.cols - hog.winSize.width);
+				int y = rng.uniform(0, imageMat.rows - hog.winSize.height);
+				cv::Rect roi = cv::Rect(cv::Point(x, y), hog.winSize);
+				fastHog.compute(imageMat(roi), descriptor);
+				if (j < nNegatives) {
+					int idx = firstRow + j + i * nNegatives;
+					LOGL(LOG_TRAIN,
+							"Sampling random patch #" << idx << " from " << roi);
+					setDescriptorRow(trainingData, idx, descriptor);
+				} else {
+					/* last patch is kept aside for evaluation */
+					setDescriptorRow(evalData, i, descriptor);
+					evalPatches[i] = imageMat(roi).clone();
+				}
+			}
 		}
 	}
-	support_vector.push_back(rho);
+
+private:
+	const std::vector<fs::path>& files;
+	const std::vector<int>& todo;
+	const cv::HOGDescriptor& hog;
+	unsigned int nNegatives;
+	unsigned int firstRow;
+	uint64 seed;
+	cv::Mat& trainingData;
+	cv::Mat& evalData;
+	std::vector<cv::Mat>& evalPatches;
+	std::vector<uchar>& failed;
+};
+
+static std::vector<std::string> splitCells(const std::string& line) {
+	std::stringstream lineStream(line);
+	std::string cell;
+	std::vector<std::string> cells;
+	while (std::getline(lineStream, cell, ';'))
+		cells.push_back(cell);
+	return cells;
 }
 
+/**
+ * Add the box in cells[first..first+3] to the boxes of the image source
+ * (indexed by file name, without directory or archive)
+ */
+static void addBibBox(std::map<std::string, std::vector<cv::Rect> >& boxes,
+		const std::string& source, const std::vector<std::string>& cells,
+		unsigned int first) {
+	std::string name = source.substr(source.find_last_of('!') + 1);
+	boxes[fs::path(name).filename().string()].push_back(
+			cv::Rect(atoi(cells[first].c_str()),
+					atoi(cells[first + 1].c_str()),
+					atoi(cells[first + 2].c_str()),
+					atoi(cells[first + 3].c_str())));
+}
 
 /**
- * Compute HOG feature descriptor from input image
- * @param filename file name of image
- * @param descriptor HOG feature descriptor
- * @param hog instance of cv::HOGDescriptor
+ * Load known bib locations in full images from a file with one
+ * "filename;x;y;width;height" line per bib, or from a crop index
+ * ("name;source;bib;x;y;width;height;angle" lines, bib crops only)
+ * @param filename path of boxes file
+ * @param boxes boxes indexed by image file name (without directory)
  */
-static void computeHOGDescriptor(const std::string filename,
-		std::vector<float>& descriptor, cv::HOGDescriptor& hog) {
-	cv::Mat imageMat = cv::imread(filename, 1);
-	cv::Mat resizedMat;
-
-	// resize to HOGDescriptor dimensions
-	cv::resize(imageMat, resizedMat, hog.winSize, 0, 0);
-	hog.compute(resizedMat, descriptor);
+static void loadBibBoxes(const fs::path& filename,
+		std::map<std::string, std::vector<cv::Rect> >& boxes) {
+	std::ifstream file(filename.c_str());
+	std::string line;
+
+	while (std::getline(file, line)) {
+		std::vector<std::string> cells = splitCells(line);
+		if (cells.size() >= 8) {
+			if (boost::algorithm::starts_with(cells[0], "bib-"))
+				addBibBox(boxes, cells[1], cells, 3);
+		} else if (cells.size() >= 5) {
+			addBibBox(boxes, cells[0], cells, 1);
+		}
+	}
 }
 
-static inline double square(double x) {
-	return x * x;
+static bool scoreSort(const std::pair<double, cv::Rect> &lhs,
+		const std::pair<double, cv::Rect> &rhs) {
+	return lhs.first > rhs.first;
 }
 
+/**
+ * Scan full images with the linear detector set in hog and collect the
+ * descriptors of the highest scoring windows that do not overlap any
+ * known bib or any window mined in a previous round: one matrix of up to
+ * maxPerImage rows per image in mined, whose windows are appended to
+ * minedBoxes. Images without known bibs are not scanned, as their bibs
+ * would be the highest scoring windows.
+ * Images are decoded again in every round rather than kept in memory: a
+ * training set holds hundreds of full size photos, and there are only a
+ * few rounds, each dominated by the pyramid scan.
+ */
+class HardNegativeInvoker: public cv::ParallelLoopBody {
+public:
+	HardNegativeInvoker(const std::vector<fs::path>& _files,
+			const std::vector<std::vector<cv::Rect> >& _bibBoxes,
+			const cv::HOGDescriptor& _hog, double _threshold,
+			unsigned int _maxPerImage, std::vector<cv::Mat>& _mined,
+			std::vector<std::vector<cv::Rect> >& _minedBoxes) :
+			files(_files), bibBoxes(_bibBoxes), hog(_hog), threshold(
+					_threshold), maxPerImage(_maxPerImage), mined(_mined), minedBoxes(
+					_minedBoxes) {
+	}
+
+	virtual void operator()(const cv::Range& range) const {
+		fasthog::FastHOG fastHog;
+		std::vector<float> descriptor;
+		for (int i = range.start; i < range.end; i++) {
+			std::vector<std::pair<double, cv::Rect> > candidates;
+			std::vector<cv::Rect> selected;
+
+			if (bibBoxes[i].empty())
+				continue;
+			cv::Mat imageMat = readUpright(files[i]);
+			if (imageMat.empty())
+				continue;
+			cv::Rect imageRect(0, 0, imageMat.cols, imageMat.rows);
+
+			/* scan image pyramid */
+			cv::Mat level = imageMat;
+			for (double scale = 1.0;
+					(level.cols >= hog.winSize.width)
+							&& (level.rows >= hog.winSize.height);
+					scale *= HARD_NEGATIVE_SCALE_STEP) {
+				std::vector<cv::Point> locations;
+				std::vector<double> weights;
+				hog.detect(level, locations, weights, threshold,
+						hog.blockStride);
+				for (unsigned int j = 0; j < locations.size(); j++) {
+					cv::Rect r(cvRound(locations[j].x * scale),
+							cvRound(locations[j].y * scale),
+							cvRound(hog.winSize.width * scale),
+							cvRound(hog.winSize.height * scale));
+					/* a clipped window would be stretched to the window size */
+					if ((r & imageRect) != r)
+						continue;
+					candidates.push_back(std::make_pair(weights[j], r));
+				}
+				cv::resize(imageMat, level,
+						cv::Size(cvRound(imageMat.cols / (scale * HARD_NEGATIVE_SCALE_STEP)),
+								cvRound(imageMat.rows / (scale * HARD_NEGATIVE_SCALE_STEP))));
+			}
+
+			/* keep best false positives, at most one per image area */
+			std::sort(candidates.begin(), candidates.end(), &scoreSort);
+			for (unsigned int j = 0;
+					(j < candidates.size()) && (selected.size() < maxPerImage);
+					j++) {
+				const cv::Rect& r = candidates[j].second;
+				bool overlaps = false;
+				for (unsigned int k = 0; (k < bibBoxes[i].size()) && !overlaps;
+						k++)
+					overlaps = (r & bibBoxes[i][k]).area() > 0;
+				for (unsigned int k = 0; (k < selected.size()) && !overlaps;
+						k++)
+					overlaps = (r & selected[k]).area() > 0;
+				for (unsigned int k = 0;
+						(k < minedBoxes[i].size()) && !overlaps; k++)
+					overlaps = (r & minedBoxes[i][k]).area() > 0;
+				if (!overlaps)
+					selected.push_back(r);
+			}
+
+			cv::Mat descriptors(selected.size(), hog.getDescriptorSize(),
+					CV_32FC1);
+			for (unsigned int j = 0; j < selected.size(); j++) {
+				LOGL(LOG_TRAIN,
+						"Hard negative " << selected[j] << " in " << files[i].string());
+				fastHog.compute(imageMat(selected[j]), descriptor);
+				setDescriptorRow(descriptors, j, descriptor);
+			}
+			mined[i] = descriptors;
+			minedBoxes[i].insert(minedBoxes[i].end(), selected.begin(),
+					selected.end());
+		}
+	}
+
+private:
+	const std::vector<fs::path>& files;
+	const std::vector<std::vector<cv::Rect> >& bibBoxes;
+	const cv::HOGDescriptor& hog;
+	double threshold;
+	unsigned int maxPerImage;
+	std::vector<cv::Mat>& mined;
+	std::vector<std::vector<cv::Rect> >& minedBoxes;
+};
+
+/* confusion counts and training time of one cross-validation task */
+struct FoldResult {
+	int tp, fp, fn, tn;
+	double seconds; /* negative if training failed */
+};
+
+/**
+ * Train and evaluate one (C value, fold) pair per task: task t holds out
+ * the rows of fold t % nFolds and trains with Cs[t / nFolds] on the rest.
+ * Training uses row subsets of the shared data, nothing is copied.
+ */
+class CrossValidationInvoker: public cv::ParallelLoopBody {
+public:
+	CrossValidationInvoker(const cv::Mat& _data, const cv::Mat& _labels,
+			const std::vector<int>& _folds, int _nFolds,
+			const std::vector<double>& _Cs, std::vector<FoldResult>& _results) :
+			data(_data), labels(_labels), folds(_folds), nFolds(_nFolds), Cs(
+					_Cs), results(_results) {
+	}
+
+	virtual void operator()(const cv::Range& range) const {
+		for (int t = range.start; t < range.end; t++) {
+			int fold = t % nFolds;
+			struct linearsvm::SolverParams solverParams = {
+					Cs[t / nFolds], /* C */
+					1000, /* max iterations */
+					0.1, /* tolerance */
+			};
+			std::vector<int> trainRows;
+			linearsvm::LinearModel model;
+			struct FoldResult &res = results[t];
+
+			for (int i = 0; i < data.rows; i++) {
+				if (folds[i] != fold)
+					trainRows.push_back(i);
+			}
+			res.tp = res.fp = res.fn = res.tn = 0;
+			int64 t0 = cv::getTickCount();
+			if (model.train(data, labels, solverParams, trainRows) < 0) {
+				res.seconds = -1;
+				continue;
+			}
+			res.seconds = (cv::getTickCount() - t0) / cv::getTickFrequency();
+
+			for (int i = 0; i < data.rows; i++) {
+				if (folds[i] != fold)
+					continue;
+				bool positive = labels.at<float>(i, 0) > 0;
+				if (model.predict(data.ptr<float>(i)) > 0) {
+					if (positive)
+						res.tp++;
+					else
+						res.fp++;
+				} else {
+					if (positive)
+						res.fn++;
+					else
+						res.tn++;
+				}
+			}
+			LOGL(LOG_TRAIN,
+					"C=" << solverParams.C << " fold " << fold << ": tp=" << res.tp
+					<< " fp=" << res.fp << " fn=" << res.fn << " tn=" << res.tn
+					<< " in " << res.seconds << "s");
+		}
+	}
+
+private:
+	const cv::Mat& data;
+	const cv::Mat& labels;
+	const std::vector<int>& folds;
+	int nFolds;
+	const std::vector<double>& Cs;
+	std::vector<FoldResult>& results;
+};
+
 namespace train {
 
+/**
+ * Score every row of data with a linear model
+ */
+static std::vector<float> predictAll(const linearsvm::LinearModel& model,
+		const cv::Mat& data) {
+	std::vector<float> scores;
+	model.predict(data, scores);
+	return scores;
+}
+
+/**
+ * Train a linear model with the solver selected in params
+ * @return training time in seconds, or a negative value on error
+ */
+static double trainModel(const cv::Mat& data, const cv::Mat& labels,
+		const struct TrainParams &params, linearsvm::LinearModel& model) {
+	int64 t = cv::getTickCount();
+
+	if (params.solver == SOLVER_CVSVM) {
+		linearsvm::LinearSVM svm;
+		CvSVMParams svmParams;
+		svmParams.svm_type = CvSVM::C_SVC;
+		svmParams.kernel_type = CvSVM::LINEAR;
+		svmParams.C = params.C;
+		svmParams.term_crit = cvTermCriteria( CV_TERMCRIT_ITER, 10000, 1e-6);
+		svm.train(data, labels, cv::Mat(), cv::Mat(), svmParams);
+		model.fromSVM(svm);
+	} else {
+		struct linearsvm::SolverParams solverParams = {
+				params.C, /* C */
+				1000, /* max iterations */
+				0.1, /* tolerance */
+		};
+		if (model.train(data, labels, solverParams) < 0)
+			return -1;
+	}
+
+	return (cv::getTickCount() - t) / cv::getTickFrequency();
+}
+
+/**
+ * Train with CvSVM and with the dual coordinate descent solver on the
+ * same 80% of the examples and report accuracy on the remaining 20%
+ */
+static void compareSolvers(const cv::Mat& data, const cv::Mat& labels,
+		const struct TrainParams &params) {
+	const enum Solver solvers[] = { SOLVER_CVSVM, SOLVER_DCD };
+	const char *names[] = { "CvSVM", "DCD" };
+	std::vector<int> index(data.rows);
+	cv::Mat trainData, trainLabels, testData, testLabels;
+	cv::RNG rng;
+
+	for (int i = 0; i < data.rows; i++)
+		index[i] = i;
+	for (int i = 0; i < data.rows - 1; i++)
+		std::swap(index[i], index[i + rng.uniform(0, data.rows - i)]);
+	for (int i = 0, nTrain = data.rows * 4 / 5; i < data.rows; i++) {
+		if (i < nTrain) {
+			trainData.push_back(data.row(index[i]));
+			trainLabels.push_back(labels.row(index[i]));
+		} else {
+			testData.push_back(data.row(index[i]));
+			testLabels.push_back(labels.row(index[i]));
+		}
+	}
+
+	for (unsigned int s = 0; s < sizeof(solvers) / sizeof(solvers[0]); s++) {
+		struct TrainParams p = params;
+		linearsvm::LinearModel model;
+		p.solver = solvers[s];
+		double t = trainModel(trainData, trainLabels, p, model);
+		if (t < 0)
+			continue;
+		std::vector<float> scores = predictAll(model, testData);
+		int correct = 0;
+		for (int i = 0; i < testData.rows; i++) {
+			if ((scores[i] > 0) == (testLabels.at<float>(i, 0) > 0))
+				correct++;
+		}
+		std::cout << names[s] << ": trained on " << trainData.rows
+				<< " examples in " << t << "s, held-out accuracy " << correct
+				<< "/" << testData.rows << std::endl;
+	}
+}
+
+/**
+ * k-fold cross-validation of the dual coordinate descent solver for every
+ * C value in params, all (C, fold) pairs trained in parallel. Rows with the
+ * same group (e.g. a positive and its augmented variants) share a fold.
+ * @return the C value with the best F-score, or a negative value on error
+ */
+static double crossValidate(const cv::Mat& data, const cv::Mat& labels,
+		const std::vector<int>& groups, int nGroups,
+		const struct TrainParams &params) {
+	int nFolds = params.folds;
+	std::vector<double> Cs = params.Cs;
+	std::vector<int> order(nGroups);
+	std::vector<int> folds(data.rows);
+	cv::RNG rng;
+
+	if (Cs.empty())
+		Cs.push_back(params.C);
+	if ((nFolds < 2) || (nFolds > nGroups)) {
+		std::cerr << "ERROR: Invalid number of folds " << nFolds << " for "
+				<< nGroups << " training images" << std::endl;
+		return -1;
+	}
+
+	/* assign groups to folds in random order */
+	for (int g = 0; g < nGroups; g++)
+		order[g] = g;
+	for (int g = 0; g < nGroups - 1; g++)
+		std::swap(order[g], order[g + rng.uniform(0, nGroups - g)]);
+	std::vector<int> groupFold(nGroups);
+	for (int g = 0; g < nGroups; g++)
+		groupFold[order[g]] = g % nFolds;
+	for (int i = 0; i < data.rows; i++)
+		folds[i] = groupFold[groups[i]];
+
+	std::vector<FoldResult> results(Cs.size() * nFolds);
+	int64 t = cv::getTickCount();
+	cv::parallel_for_(cv::Range(0, results.size()),
+			CrossValidationInvoker(data, labels, folds, nFolds, Cs, results));
+	std::cout << nFolds << "-fold cross-validation of " << Cs.size()
+			<< " C values on " << data.rows << " examples took "
+			<< (cv::getTickCount() - t) / cv::getTickFrequency() << "s"
+			<< std::endl;
+
+	double bestC = -1, bestF = -1;
+	for (unsigned int c = 0; c < Cs.size(); c++) {
+		int tp = 0, fp = 0, fn = 0;
+		double seconds = 0;
+		bool failed = false;
+		for (int f = 0; f < nFolds; f++) {
+			const struct FoldResult &res = results[c * nFolds + f];
+			failed |= (res.seconds < 0);
+			tp += res.tp;
+			fp += res.fp;
+			fn += res.fn;
+			seconds += res.seconds;
+		}
+		if (failed) {
+			std::cout << "C=" << Cs[c] << ": training failed" << std::endl;
+			continue;
+		}
+		double precision = (tp + fp) ? (double) tp / (tp + fp) : 0;
+		double recall = (tp + fn) ? (double) tp / (tp + fn) : 0;
+		double F = (precision + recall > 0) ?
+				2 * precision * recall / (precision + recall) : 0;
+		std::cout << "C=" << Cs[c] << ": precision " << precision
+				<< " recall " << recall << " F-score " << F << ", "
+				<< seconds / nFolds << "s training per fold" << std::endl;
+		if (F > bestF) {
+			bestF = F;
+			bestC = Cs[c];
+		}
+	}
+	if (bestC > 0)
+		std::cout << "Selected C=" << bestC << std::endl;
+	return bestC;
+}
+
 // HOGDescriptor visual_imagealizer
 // adapted for arbitrary size of feature sets and training images
 cv::Mat hogVisualizeStdBlkSize(cv::Mat& origImg,
@@ -289,24 +874,34 @@ cv::Mat hogVisualizeSingleBlock(cv::Mat& origImg,
 
 }
 
-int process(std::string trainDir, std::string inputDir) {
+int process(std::string trainDir, std::string inputDir,
+		const struct TrainParams &trainParams) {
+	featurestore::FeatureStore store;
 
-	if ((!fs::is_directory(trainDir)) || (!fs::is_directory(inputDir))) {
+	/* positives can be read from a crop archive instead of a directory */
+	bool fromArchive = tar::isArchive(trainDir);
+	if (((!fs::is_directory(trainDir)) && (!fromArchive))
+			|| (!fs::is_directory(inputDir))) {
 		std::cerr << "Invalid parameters (not directories as expeceted)";
 		return -1;
 	}
 
-	cv::HOGDescriptor hog(cv::Size(128, 64), /* windows size */
-	cv::Size(16, 16), /* block size */
-	cv::Size(8, 8), /* block stride */
-	cv::Size(8, 8), /* cell size */
-	9 /* nbins */
-	);
+	cv::HOGDescriptor hog = fasthog::FastHOG::descriptor();
 
 	/* find positive image files names */
 	std::cout << "Training from positives in " << trainDir << " image data in "
 			<< inputDir << std::endl;
-	std::vector<fs::path> positiveImgFiles = batch::getImageFiles(trainDir);
+	std::vector<fs::path> positiveImgFiles;
+	std::vector<struct tar::Entry> positiveEntries;
+	if (fromArchive) {
+		if (cropwriter::readArchive(trainDir, "bib-", positiveEntries) < 0)
+			return -1;
+		for (unsigned int i = 0; i < positiveEntries.size(); i++)
+			positiveImgFiles.push_back(
+					fs::path(trainDir) / positiveEntries[i].name);
+	} else {
+		positiveImgFiles = batch::getImageFiles(trainDir);
+	}
 
 	/* find full image files names */
 	std::cout << "Training from full images in " << trainDir
@@ -315,25 +910,84 @@ int process(std::string trainDir, std::string inputDir) {
 
 	const int nRandomNegativesPerImage = 5;
 	unsigned int nPositives = positiveImgFiles.size();
+	/* each positive followed by its augmented variants */
+	unsigned int nVariants = 1 + trainParams.augmentations;
+	unsigned int nPositiveRows = nPositives * nVariants;
 	unsigned int nNegatives = fullImgFiles.size() * nRandomNegativesPerImage;
-	unsigned int rows = nPositives + nNegatives; /* one row per training example */
+	unsigned int rows = nPositiveRows + nNegatives; /* one row per training example */
 	unsigned int cols = hog.getDescriptorSize(); /* one column per descriptor field */
 
 	cv::Mat trainingData(rows, cols, CV_32FC1);
+	cv::Mat evalData(fullImgFiles.size(), cols, CV_32FC1);
+	std::vector<cv::Mat> evalPatches(fullImgFiles.size());
+	std::vector<int> todoPositives;
+	std::vector<int> todoFullImgs;
+	/* not bool: flags are set concurrently */
+	std::vector<uchar> failedPositives(nPositives, 0);
+	std::vector<uchar> failedFullImgs(fullImgFiles.size(), 0);
+
+	/* reuse cached features of unchanged files */
+	if (!trainParams.featureStore.empty()) {
+		if (store.open(trainParams.featureStore) < 0)
+			return -1;
+		store.reset(hog);
+	}
+	for (unsigned int i = 0; i < nPositives; i++) {
+		/* archive entries have no file to check for changes */
+		cv::Mat cached =
+				fromArchive ?
+						cv::Mat() :
+						store.lookup(positiveImgFiles[i], 1, nVariants);
+		if (cached.empty())
+			todoPositives.push_back(i);
+		else
+			cached.copyTo(
+					trainingData.rowRange(i * nVariants, (i + 1) * nVariants));
+	}
+	for (unsigned int i = 0; i < fullImgFiles.size(); i++) {
+		/* random negatives followed by the evaluation patch */
+		cv::Mat cached = store.lookup(fullImgFiles[i], -1,
+				nRandomNegativesPerImage + 1);
+		if (cached.empty()) {
+			todoFullImgs.push_back(i);
+		} else {
+			unsigned int first = nPositiveRows + i * nRandomNegativesPerImage;
+			cached.rowRange(0, nRandomNegativesPerImage).copyTo(
+					trainingData.rowRange(first,
+							first + nRandomNegativesPerImage));
+			cached.row(nRandomNegativesPerImage).copyTo(evalData.row(i));
+		}
+	}
+	if (!trainParams.featureStore.empty()) {
+		std::cout << "Feature store " << trainParams.featureStore << ": "
+				<< nPositives - todoPositives.size() << "/" << nPositives
+				<< " positives and "
+				<< fullImgFiles.size() - todoFullImgs.size() << "/"
+				<< fullImgFiles.size() << " full images cached" << std::endl;
+	}
 
-	/* compute features for positive examples */
-	cv::Mat aggregateDescriptor(1, cols, CV_32FC1, cv::Scalar(0));
-	for (unsigned i = 0; i < nPositives; i++) {
-		std::cout << "Opening positive example " << positiveImgFiles[i].string()
-				<< std::endl;
-		std::vector<float> descriptor;
-		computeHOGDescriptor(positiveImgFiles[i].string().c_str(), descriptor,
-				hog);
-		trainingData.row(i) = cv::Mat(descriptor).t();
-		aggregateDescriptor += trainingData.row(i);
+	/* compute features for positive examples and their variants */
+	std::cout << "Computing descriptors for " << todoPositives.size()
+			<< " positives (" << trainParams.augmentations
+			<< " augmented variants each)" << std::endl;
+	cv::parallel_for_(cv::Range(0, todoPositives.size()),
+			PositiveDescriptorInvoker(positiveImgFiles, positiveEntries,
+					todoPositives, trainParams.augmentations, trainingData,
+					failedPositives));
+
+	/* rows of the examples that could be read, the others are dropped */
+	std::vector<int> validRows;
+	for (unsigned int i = 0; i < nPositives; i++) {
+		if (failedPositives[i])
+			continue;
+		for (unsigned int j = 0; j < nVariants; j++)
+			validRows.push_back(i * nVariants + j);
 	}
 
-	aggregateDescriptor /= nPositives;
+	cv::Mat aggregateDescriptor(1, cols, CV_32FC1, cv::Scalar(0));
+	if (!validRows.empty())
+		cv::reduce(selectRows(trainingData, validRows), aggregateDescriptor,
+				0, CV_REDUCE_AVG);
 	const float*p = aggregateDescriptor.ptr<float>(0);
 	std::vector<float> vec(p, p+aggregateDescriptor.cols);
 	cv::Mat zMat = cv::Mat::zeros(hog.winSize,CV_32FC1);
@@ -341,78 +995,205 @@ int process(std::string trainDir, std::string inputDir) {
 				hog.winSize, hog.cellSize, 5, 2.5);
 	cv::imwrite("hog-viz.png", visualImage);
 
-	/* compute features for negative examples */
+	/* compute features for negative examples, along with one extra random
+	 * patch per full image that is used to evaluate the model */
+	std::cout << "Computing descriptors for "
+			<< todoFullImgs.size() * nRandomNegativesPerImage
+			<< " random negatives from " << todoFullImgs.size()
+			<< " full images" << std::endl;
 	std::srand(std::time(0)); // use current time as seed for random generator
-	for (unsigned i = 0, end = fullImgFiles.size(); i < end; i++) {
-		std::cout << "Opening full image " << fullImgFiles[i].string()
-				<< std::endl;
-		cv::Mat imageMat = cv::imread(fullImgFiles[i].string().c_str(), 1);
-		for (unsigned int j = 0; j < nRandomNegativesPerImage; j++) {
-			std::vector<float> descriptor;
-			int x = std::rand() % (imageMat.cols - hog.winSize.width);
-			int y = std::rand() % (imageMat.rows - hog.winSize.height);
-			int idx = nPositives + j + i * nRandomNegativesPerImage;
-			cv::Rect roi = cv::Rect(cv::Point(x, y), hog.winSize);
-			std::cout << "Sampling random patch #" << idx << " from " << roi
-					<< std::endl;
-			hog.compute(imageMat(roi), descriptor);
-			trainingData.row(idx) = cv::Mat(descriptor).t();
+	cv::parallel_for_(cv::Range(0, todoFullImgs.size()),
+			NegativeDescriptorInvoker(fullImgFiles, todoFullImgs, hog,
+					nRandomNegativesPerImage, nPositiveRows, std::time(0),
+					trainingData, evalData, evalPatches, failedFullImgs));
+
+	/* add new features to the store */
+	if (!trainParams.featureStore.empty()) {
+		int res = 0;
+		for (unsigned int k = 0; (!fromArchive) && (k < todoPositives.size());
+				k++) {
+			int i = todoPositives[k];
+			if (failedPositives[i])
+				continue;
+			res |= store.append(positiveImgFiles[i], 1,
+					trainingData.rowRange(i * nVariants, (i + 1) * nVariants));
+		}
+		for (unsigned int k = 0; k < todoFullImgs.size(); k++) {
+			int i = todoFullImgs[k];
+			unsigned int first = nPositiveRows + i * nRandomNegativesPerImage;
+			cv::Mat descriptors;
+			if (failedFullImgs[i])
+				continue;
+			cv::vconcat(
+					trainingData.rowRange(first,
+							first + nRandomNegativesPerImage), evalData.row(i),
+					descriptors);
+			res |= store.append(fullImgFiles[i], -1, descriptors);
 		}
+		res |= store.save();
+		if (res < 0)
+			std::cerr << "ERROR: Could not update feature store" << std::endl;
+	}
+
+	unsigned int nFailedFullImgs = 0;
+	for (unsigned int i = 0; i < fullImgFiles.size(); i++) {
+		if (failedFullImgs[i]) {
+			nFailedFullImgs++;
+			continue;
+		}
+		unsigned int first = nPositiveRows + i * nRandomNegativesPerImage;
+		for (int j = 0; j < nRandomNegativesPerImage; j++)
+			validRows.push_back(first + j);
+	}
+	if (validRows.size() < rows) {
+		std::cout << "Skipping "
+				<< std::count(failedPositives.begin(), failedPositives.end(), 1)
+				<< " positives and " << nFailedFullImgs
+				<< " full images that could not be read" << std::endl;
 	}
 
-	std::cout << "descriptors :" << trainingData.size() << std::endl;
 	cv::Mat labels(rows, 1, CV_32FC1, cv::Scalar(-1.0));
-	labels.rowRange(0, nPositives) = cv::Scalar(1.0);
-
-	LinearSVM svm;
-	CvSVMParams params;
-	params.svm_type = CvSVM::C_SVC;
-	params.kernel_type = CvSVM::LINEAR;
-	params.term_crit = cvTermCriteria( CV_TERMCRIT_ITER, 10000, 1e-6);
-
-	svm.train(trainingData, labels, cv::Mat(), cv::Mat(), params);
-	svm.save("svm.xml");
-
-	for (unsigned int i = 0; i < rows; i++) {
-		/* show measure of distance to average positive feature */
-		double distance=0;
-		for(unsigned int j=0;j<cols;j++)
-		{
-			distance += square(trainingData.at<float>(i,j) - aggregateDescriptor.at<float>(0,j));
+	labels.rowRange(0, nPositiveRows) = cv::Scalar(1.0);
+	/* a positive and its variants, the patches of a full image, share a fold */
+	std::vector<int> allGroups(rows);
+	for (unsigned int i = 0; i < nPositiveRows; i++)
+		allGroups[i] = i / nVariants;
+	for (unsigned int i = 0; i < nNegatives; i++)
+		allGroups[nPositiveRows + i] = nPositives + i / nRandomNegativesPerImage;
+	std::vector<int> groups;
+	for (unsigned int i = 0; i < validRows.size(); i++)
+		groups.push_back(allGroups[validRows[i]]);
+	trainingData = selectRows(trainingData, validRows);
+	labels = selectRows(labels, validRows);
+	std::cout << "descriptors :" << trainingData.size() << std::endl;
+
+	if (trainParams.compareSolvers)
+		compareSolvers(trainingData, labels, trainParams);
+
+	struct TrainParams params = trainParams;
+	if (trainParams.folds > 0) {
+		params.C = crossValidate(trainingData, labels, groups,
+				nPositives + fullImgFiles.size(), trainParams);
+		if (params.C <= 0)
+			return -1;
+	}
+
+	linearsvm::LinearModel model;
+	double t = trainModel(trainingData, labels, params, model);
+	if (t < 0)
+		return -1;
+	std::cout << "Trained on " << trainingData.rows << " examples in " << t
+			<< "s" << std::endl;
+
+	/* hard-negative mining: add high-scoring false positives and retrain */
+	if (trainParams.hardNegativeRounds > 0) {
+		/* known bib locations, including those of the saved bib crops */
+		std::map<std::string, std::vector<cv::Rect> > boxes;
+		loadBibBoxes(fs::path(inputDir) / BIB_BOXES_FILE, boxes);
+		loadBibBoxes(fs::path(inputDir) / CROP_INDEX_FILE, boxes);
+		if (fromArchive) {
+			/* comment: source;bib;x;y;width;height;angle */
+			for (unsigned int i = 0; i < positiveEntries.size(); i++) {
+				std::vector<std::string> cells = splitCells(
+						positiveEntries[i].comment);
+				if (cells.size() >= 6)
+					addBibBox(boxes, cells[0], cells, 2);
+			}
+		} else {
+			loadBibBoxes(fs::path(trainDir) / CROP_INDEX_FILE, boxes);
+		}
+		std::vector<std::vector<cv::Rect> > bibBoxes(fullImgFiles.size());
+		unsigned int nKnown = 0;
+		for (unsigned int i = 0; i < fullImgFiles.size(); i++) {
+			bibBoxes[i] = boxes[fullImgFiles[i].filename().string()];
+			if (!bibBoxes[i].empty())
+				nKnown++;
+		}
+		std::cout << "Mining hard negatives in " << nKnown << "/"
+				<< fullImgFiles.size()
+				<< " full images with known bib locations (" << BIB_BOXES_FILE
+				<< " or " << CROP_INDEX_FILE << ")" << std::endl;
+
+		std::vector<std::vector<cv::Rect> > minedBoxes(fullImgFiles.size());
+		for (int round = 0; (round < trainParams.hardNegativeRounds)
+				&& (nKnown > 0); round++) {
+			std::vector<cv::Mat> mined(fullImgFiles.size());
+			cv::HOGDescriptor detector = hog;
+
+			detector.setSVMDetector(model.detector());
+			cv::parallel_for_(cv::Range(0, fullImgFiles.size()),
+					HardNegativeInvoker(fullImgFiles, bibBoxes, detector,
+							trainParams.hardNegativeThreshold,
+							trainParams.maxHardNegativesPerImage, mined,
+							minedBoxes));
+
+			unsigned int nMined = 0;
+			for (unsigned int i = 0; i < mined.size(); i++) {
+				if (mined[i].empty())
+					continue;
+				trainingData.push_back(mined[i]);
+				labels.push_back(
+						cv::Mat(mined[i].rows, 1, CV_32FC1, cv::Scalar(-1.0)));
+				nMined += mined[i].rows;
+			}
+			std::cout << "Hard-negative round " << round + 1 << ": " << nMined
+					<< " new negatives, " << trainingData.rows
+					<< " training examples" << std::endl;
+			if (nMined == 0)
+				break;
+			if (trainModel(trainingData, labels, params, model) < 0)
+				return -1;
+		}
+	}
+	model.setHOG(hog);
+	model.save("svm.xml");
+	model.saveBinary("svm.bin");
+
+	unsigned int nErrors = 0;
+	std::vector<float> predictions = predictAll(model, trainingData);
+	for (int i = 0; i < trainingData.rows; i++) {
+		float prediction = predictions[i];
+		if ((prediction > 0) != (labels.at<float>(i, 0) > 0))
+			nErrors++;
+		if (LOG_MASK & LOG_TRAIN) {
+			/* show measure of distance to average positive feature */
+			double distance = cv::norm(trainingData.row(i),
+					aggregateDescriptor, cv::NORM_L2SQR);
+			LOGL(LOG_TRAIN,
+					i << " dist=" << distance <<" prediction=" << prediction);
 		}
-		float prediction = svm.predict(trainingData.row(i));
-		std::cout << i << " dist=" << distance <<" prediction=" << prediction << std::endl;
 	}
+	std::cout << "Training errors: " << nErrors << "/" << trainingData.rows
+			<< std::endl;
 
+	unsigned int nDetections = 0;
 	for (unsigned i = 0, end = fullImgFiles.size(); i < end; i++) {
-		std::cout << "Opening full image " << fullImgFiles[i].string()
-				<< std::endl;
-		cv::Mat imageMat = cv::imread(fullImgFiles[i].string().c_str(), 1);
-		std::vector<float> descriptor;
-		int x = std::rand() % (imageMat.cols - hog.winSize.width);
-		int y = std::rand() % (imageMat.rows - hog.winSize.height);
-		cv::Rect roi = cv::Rect(cv::Point(x, y), hog.winSize);
-		std::cout << "Sampling random patch from " << roi << std::endl;
-		hog.compute(imageMat(roi), descriptor);
-		float prediction = svm.predict(cv::Mat(descriptor).t());
-		std::cout << i << " prediction=" << prediction << std::endl;
-		if (prediction > 0.5) {
+		if (failedFullImgs[i])
+			continue;
+		float prediction = model.predict(evalData.row(i));
+		LOGL(LOG_TRAIN,
+				i << " " << fullImgFiles[i].string() << " prediction=" << prediction);
+		if (prediction > 0) {
+			nDetections++;
+			/* patch pixels are only available for freshly decoded images */
+			if (evalPatches[i].empty())
+				continue;
 			char *filename;
 			asprintf(&filename, "positive-%d.png", i);
-			cv::imwrite(filename, imageMat(roi));
+			cv::imwrite(filename, evalPatches[i]);
 			free(filename);
 		}
 	}
+	std::cout << "Random patches predicted positive: " << nDetections << "/"
+			<< fullImgFiles.size() << std::endl;
 
 #if 0
 	{
 		std::cout << "Opening full image " << fullImgFiles[0].string()
 		<< std::endl;
 		cv::Mat imageMat = cv::imread(fullImgFiles[0].string().c_str(), 1);
-		std::vector<float> support_vector;
-		svm.getSupportVector(support_vector);
 		std::vector<cv::Rect> locations;
-		hog.setSVMDetector(support_vector);
+		hog.setSVMDetector(model.detector());
 		hog.detectMultiScale(imageMat, locations, 0.0, cv::Size(), cv::Size(), 1.01);
 		for (unsigned int i = 0; i < locations.size(); ++i) {
 			cv::rectangle(imageMat, locations[i], cv::Scalar(64, 255, 64), 3);
@@ -421,37 +1202,6 @@ int process(std::string trainDir, std::string inputDir) {
 	}
 #endif
 
-#if 1
-	{
-		std::cout << "Opening full image " << fullImgFiles[0].string()
-				<< std::endl;
-		//cv::Mat imageMat = cv::imread(fullImgFiles[0].string().c_str(), 1);
-		cv::Mat imageMat = cv::imread("../samples/prom.jpg", 1);
-
-		for (unsigned int j = 0; j < 1000; j++) {
-			std::vector<float> descriptor;
-			int x = std::rand() % (imageMat.cols - hog.winSize.width);
-			int y = std::rand() % (imageMat.rows - hog.winSize.height);
-			cv::Rect roi = cv::Rect(cv::Point(x, y), hog.winSize);
-			std::cout << "Sampling random patch from " << roi
-					<< std::endl;
-			hog.compute(imageMat(roi), descriptor);
-			float prediction = svm.predict(cv::Mat(descriptor).t());
-			if (prediction > 0.5) {
-				std::cout << "detection!" << std::endl;
-				cv::rectangle(imageMat, roi, cv::Scalar(64, 255, 64),
-						3);
-			}
-			else
-			{
-				cv::rectangle(imageMat, roi, cv::Scalar(0, 0, 0),
-										1);
-			}
-		}
-		cv::imwrite("detection.png", imageMat);
-
-	}
-#endif
 	return 0;
 }
 
@@ -2,18 +2,43 @@
 #define TRAIN_H
 
 #include <string>
+#include <vector>
 
 #include "opencv2/imgproc/imgproc.hpp"
 
 namespace train
 {
+	enum Solver {
+		SOLVER_DCD, /* dual coordinate descent linear SVM */
+		SOLVER_CVSVM /* CvSVM C_SVC with linear kernel */
+	};
+
+	struct TrainParams {
+		TrainParams() :
+				augmentations(0), hardNegativeRounds(0), maxHardNegativesPerImage(10),
+				hardNegativeThreshold(0.0), solver(SOLVER_DCD), C(1.0),
+				compareSolvers(false), folds(0) {
+		}
+		std::string featureStore; /* HOG feature cache directory, empty to disable */
+		unsigned int augmentations; /* augmented variants generated per positive */
+		int hardNegativeRounds; /* hard-negative mining rounds after initial training */
+		unsigned int maxHardNegativesPerImage; /* mined negatives per full image and round */
+		double hardNegativeThreshold; /* minimum detector score of a mined negative */
+		enum Solver solver;
+		double C; /* SVM penalty parameter */
+		bool compareSolvers; /* report held-out accuracy of both solvers */
+		unsigned int folds; /* cross-validation folds, 0 to disable */
+		std::vector<double> Cs; /* C values to cross-validate, C if empty */
+	};
+
 	cv::Mat hogVisualizeSingleBlock(cv::Mat& origImg,
 		std::vector<float>& descriptorValues, cv::Size winSize,
 		cv::Size cellSize, int scaleFactor, double viz_factor);
 	cv::Mat hogVisualizeStdBlkSize(cv::Mat& origImg,
 			std::vector<float>& descriptorValues, cv::Size winSize,
 			cv::Size cellSize, int scaleFactor, double viz_factor);
-	int process(std::string trainDir, std::string inputDir);
+	int process(std::string trainDir, std::string inputDir,
+			const struct TrainParams &params);
 }
 
 #endif /* #ifndef TRAIN_H */
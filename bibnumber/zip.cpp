@@ -0,0 +1,284 @@
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+
+#include <zlib.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+
+#include "zip.h"
+
+namespace fs = boost::filesystem;
+
+#define ZIP_LOCAL_HEADER_SIG 0x04034b50
+#define ZIP_CENTRAL_HEADER_SIG 0x02014b50
+#define ZIP_END_SIG 0x06054b50
+#define ZIP64_END_SIG 0x06064b50
+#define ZIP64_LOCATOR_SIG 0x07064b50
+#define ZIP64_EXTRA_ID 0x0001
+#define ZIP_LOCAL_HEADER_SIZE 30
+#define ZIP_CENTRAL_HEADER_SIZE 46
+#define ZIP_END_SIZE 22
+#define ZIP64_END_SIZE 56
+#define ZIP64_LOCATOR_SIZE 20
+/* the end record is followed by a comment of at most 64 kB */
+#define ZIP_MAX_COMMENT 0xffff
+
+#define ZIP_STORED 0
+#define ZIP_DEFLATED 8
+
+/* little-endian fields */
+static unsigned int get16(const unsigned char *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned int get32(const unsigned char *p) {
+	return get16(p) | ((unsigned int) get16(p + 2) << 16);
+}
+
+static off_t get64(const unsigned char *p) {
+	return get32(p) | ((off_t) get32(p + 4) << 32);
+}
+
+static std::time_t dosTime(unsigned int time, unsigned int date) {
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = (date >> 9) + 80;
+	tm.tm_mon = ((date >> 5) & 0xf) - 1;
+	tm.tm_mday = date & 0x1f;
+	tm.tm_hour = time >> 11;
+	tm.tm_min = (time >> 5) & 0x3f;
+	tm.tm_sec = (time & 0x1f) * 2;
+	tm.tm_isdst = -1;
+	return mktime(&tm);
+}
+
+static int readAt(FILE *file, off_t offset, unsigned char *buf, size_t len) {
+	if ((fseeko(file, offset, SEEK_SET) != 0)
+			|| (fread(buf, 1, len, file) != len))
+		return -1;
+	return 0;
+}
+
+namespace zip {
+
+ZipReader::ZipReader(void) :
+		file(NULL), nextRecord(0) {
+}
+
+ZipReader::~ZipReader(void) {
+	close();
+}
+
+int ZipReader::open(std::string _path) {
+	close();
+	path = _path;
+	file = fopen(path.c_str(), "rb");
+	if (!file) {
+		std::cerr << "ERROR: Could not open " << path << std::endl;
+		return -1;
+	}
+	if (readCentralDirectory() < 0) {
+		std::cerr << "ERROR: Not a zip archive or damaged: " << path
+				<< std::endl;
+		close();
+		return -1;
+	}
+	return 0;
+}
+
+void ZipReader::close(void) {
+	if (file)
+		fclose(file);
+	file = NULL;
+	records.clear();
+	nextRecord = 0;
+}
+
+int ZipReader::readCentralDirectory(void) {
+	boost::system::error_code ec;
+	off_t fileSize = fs::file_size(path, ec);
+	if (ec || (fileSize < ZIP_END_SIZE))
+		return -1;
+
+	/* find the end of central directory record, scanning backwards */
+	off_t tailSize = std::min(fileSize, (off_t) (ZIP_END_SIZE + ZIP_MAX_COMMENT));
+	std::vector<unsigned char> tail(tailSize);
+	if (readAt(file, fileSize - tailSize, &tail[0], tailSize) < 0)
+		return -1;
+	off_t end = -1;
+	for (off_t i = tailSize - ZIP_END_SIZE; i >= 0; i--) {
+		if (get32(&tail[i]) == ZIP_END_SIG) {
+			end = i;
+			break;
+		}
+	}
+	if (end < 0)
+		return -1;
+	off_t count = get16(&tail[end + 10]);
+	off_t dirSize = get32(&tail[end + 12]);
+	off_t dirOffset = get32(&tail[end + 16]);
+
+	if ((count == 0xffff) || (dirSize == 0xffffffff)
+			|| (dirOffset == 0xffffffff)) {
+		/* zip64 end of central directory record, found through its locator */
+		unsigned char locator[ZIP64_LOCATOR_SIZE];
+		unsigned char end64[ZIP64_END_SIZE];
+		off_t endOffset = fileSize - tailSize + end;
+		if ((endOffset < ZIP64_LOCATOR_SIZE)
+				|| (readAt(file, endOffset - ZIP64_LOCATOR_SIZE, locator,
+						ZIP64_LOCATOR_SIZE) < 0)
+				|| (get32(locator) != ZIP64_LOCATOR_SIG)
+				|| (readAt(file, get64(locator + 8), end64, ZIP64_END_SIZE) < 0)
+				|| (get32(end64) != ZIP64_END_SIG))
+			return -1;
+		count = get64(end64 + 32);
+		dirSize = get64(end64 + 40);
+		dirOffset = get64(end64 + 48);
+	}
+	if (dirOffset + dirSize > fileSize)
+		return -1;
+
+	std::vector<unsigned char> dir(dirSize + 1);
+	if ((dirSize > 0) && (readAt(file, dirOffset, &dir[0], dirSize) < 0))
+		return -1;
+	off_t pos = 0;
+	for (off_t k = 0; k < count; k++) {
+		if ((pos + ZIP_CENTRAL_HEADER_SIZE > dirSize)
+				|| (get32(&dir[pos]) != ZIP_CENTRAL_HEADER_SIG))
+			return -1;
+		const unsigned char *h = &dir[pos];
+		unsigned int nameLen = get16(h + 28);
+		unsigned int extraLen = get16(h + 30);
+		unsigned int commentLen = get16(h + 32);
+		if (pos + ZIP_CENTRAL_HEADER_SIZE + nameLen + extraLen + commentLen
+				> dirSize)
+			return -1;
+
+		struct Record record;
+		record.method = get16(h + 10);
+		record.mtime = dosTime(get16(h + 12), get16(h + 14));
+		record.compressedSize = get32(h + 20);
+		record.size = get32(h + 24);
+		record.offset = get32(h + 42);
+		record.name.assign((const char *) h + ZIP_CENTRAL_HEADER_SIZE, nameLen);
+		record.comment.assign(
+				(const char *) h + ZIP_CENTRAL_HEADER_SIZE + nameLen + extraLen,
+				commentLen);
+
+		/* 64-bit values of the fields set to 0xffffffff, in this order */
+		const unsigned char *extra = h + ZIP_CENTRAL_HEADER_SIZE + nameLen;
+		for (unsigned int e = 0; e + 4 <= extraLen;) {
+			unsigned int id = get16(extra + e);
+			unsigned int len = get16(extra + e + 2);
+			if (e + 4 + len > extraLen)
+				break;
+			if (id == ZIP64_EXTRA_ID) {
+				const unsigned char *v = extra + e + 4;
+				const unsigned char *vEnd = v + len;
+				if ((record.size == 0xffffffff) && (v + 8 <= vEnd)) {
+					record.size = get64(v);
+					v += 8;
+				}
+				if ((record.compressedSize == 0xffffffff) && (v + 8 <= vEnd)) {
+					record.compressedSize = get64(v);
+					v += 8;
+				}
+				if ((record.offset == 0xffffffff) && (v + 8 <= vEnd))
+					record.offset = get64(v);
+			}
+			e += 4 + len;
+		}
+		pos += ZIP_CENTRAL_HEADER_SIZE + nameLen + extraLen + commentLen;
+
+		if (!boost::algorithm::ends_with(record.name, "/"))
+			records.push_back(record);
+	}
+	/* read the data sequentially */
+	std::sort(records.begin(), records.end());
+	nextRecord = 0;
+	return 0;
+}
+
+int ZipReader::readData(const struct Record& record,
+		std::vector<unsigned char>& data) {
+	unsigned char header[ZIP_LOCAL_HEADER_SIZE];
+
+	/* local header name and extra field lengths may differ from the
+	 * central directory */
+	if ((readAt(file, record.offset, header, ZIP_LOCAL_HEADER_SIZE) < 0)
+			|| (get32(header) != ZIP_LOCAL_HEADER_SIG)) {
+		std::cerr << "ERROR: Bad local header for " << record.name << " in "
+				<< path << std::endl;
+		return -1;
+	}
+	off_t dataOffset = record.offset + ZIP_LOCAL_HEADER_SIZE
+			+ get16(header + 26) + get16(header + 28);
+
+	std::vector<unsigned char> compressed;
+	std::vector<unsigned char> &raw =
+			(record.method == ZIP_STORED) ? data : compressed;
+	raw.resize(record.compressedSize);
+	if ((record.compressedSize > 0)
+			&& (readAt(file, dataOffset, &raw[0], record.compressedSize) < 0)) {
+		std::cerr << "ERROR: Truncated archive " << path << std::endl;
+		return -1;
+	}
+	if (record.method == ZIP_STORED)
+		return 0;
+
+	if (record.method != ZIP_DEFLATED) {
+		std::cerr << "ERROR: Unsupported compression method "
+				<< record.method << " for " << record.name << " in " << path
+				<< std::endl;
+		return -1;
+	}
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+		return -1;
+	data.resize(record.size);
+	stream.next_in = compressed.empty() ? Z_NULL : &compressed[0];
+	stream.avail_in = compressed.size();
+	stream.next_out = data.empty() ? Z_NULL : &data[0];
+	stream.avail_out = data.size();
+	int res = inflate(&stream, Z_FINISH);
+	inflateEnd(&stream);
+	if ((res != Z_STREAM_END) || (stream.total_out != data.size())) {
+		std::cerr << "ERROR: Could not inflate " << record.name << " in "
+				<< path << std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+int ZipReader::next(struct tar::Entry& entry,
+		bool (*wanted)(std::string name)) {
+	if (!file)
+		return -1;
+	while (nextRecord < records.size()) {
+		const struct Record &record = records[nextRecord++];
+		if (wanted && !wanted(record.name))
+			continue;
+		entry.name = record.name;
+		entry.comment = record.comment;
+		entry.mtime = record.mtime;
+		entry.size = record.size;
+		if (readData(record, entry.data) < 0) {
+			/* skip damaged entries */
+			continue;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+bool isArchive(std::string path) {
+	std::string name(path);
+	std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+	return boost::algorithm::ends_with(name, ".zip") && fs::is_regular_file(path);
+}
+
+} /* namespace zip */
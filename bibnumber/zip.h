@@ -0,0 +1,64 @@
+#ifndef ZIP_H
+#define ZIP_H
+
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "tar.h"
+
+namespace zip
+{
+	/**
+	 * Reader of zip archives (stored and deflated entries, zip64). The
+	 * central directory is read when opening, then entries are returned in
+	 * the order of their data in the file, so that the archive is read
+	 * sequentially. Entries are returned as tar::Entry, with the zip file
+	 * comment as comment.
+	 */
+	class ZipReader {
+	public:
+		ZipReader(void);
+		~ZipReader(void);
+		int open(std::string path);
+		void close(void);
+		bool isOpen(void) const { return file != NULL; }
+		/**
+		 * Read the next regular file whose name is accepted by wanted (all
+		 * files if NULL)
+		 * @return 1 if an entry was read, 0 at the end of the archive, -1 on
+		 * error
+		 */
+		int next(struct tar::Entry& entry,
+				bool (*wanted)(std::string name) = NULL);
+	private:
+		/* central directory record */
+		struct Record {
+			std::string name;
+			std::string comment;
+			unsigned int method;
+			off_t compressedSize;
+			off_t size;
+			off_t offset; /* of the local header */
+			std::time_t mtime;
+			bool operator<(const struct Record& other) const {
+				return offset < other.offset;
+			}
+		};
+		int readCentralDirectory(void);
+		int readData(const struct Record& record,
+				std::vector<unsigned char>& data);
+
+		FILE *file;
+		std::string path;
+		std::vector<struct Record> records;
+		unsigned int nextRecord;
+	};
+
+	bool isArchive(std::string path);
+}
+
+#endif /* #ifndef ZIP_H */